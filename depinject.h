@@ -37,138 +37,3939 @@
 //       depinject will not maintain a common pointer to the new object for other classes
 //       to use.  In this case, the get_unique() caller is responsible for the ultimate
 //       destruction of the returned object.
+//
+//     * A unique registration may instead be "pooled": instances released through the
+//       UniquePtr<> handle returned by get_unique_ptr() are reset by an optional user
+//       hook and recycled by later get_unique() / get_unique_ptr() calls.
+//
+//     * get_unique_n() retrieves many unique instances at once.  If the declaration names
+//       its concrete class (declare_unique_of<>()), they are constructed side by side in a
+//       single cache-line aligned allocation, which is freed when the last handle to any
+//       of them is released.
+//
+//     * A non-unique registration may instead be "thread-local": get() then returns an
+//       instance belonging to the calling thread, built on that thread's first get() and
+//       destroyed when the thread exits.
+//
+//     * A non-unique registration may instead be "per-CPU": get() then returns the
+//       instance belonging to the CPU the caller is running on, each in cache lines of
+//       its own.  The caller may be moved to another CPU at any moment, so per-CPU
+//       instances must still be safe for concurrent use (by relaxed atomics, say); they
+//       are merely rarely shared.  visit_per_cpu() and reduce_per_cpu() walk them all.
+//
+//     * A non-unique registration may instead be "scoped": get() then returns the
+//       instance belonging to the Scope current on the calling thread, constructed in
+//       that Scope's arena on first use and destroyed along with the Scope.
+//
+// Notes on in-place instances:
+//
+//     * A shared registration naming its concrete class (declare_inplace<>()) has its
+//       instance constructed in a static region reserved for such instances rather
+//       than on the heap.  The region starts on a cache-line boundary and is handed out
+//       in build order, each instance at its own alignment, so that instances built
+//       together (as by prewarm()) share cache lines and pages.
+//
+//     * The region holds DEPINJECT_INPLACE_CAPACITY bytes, after which it continues in
+//       heap blocks: instances built once it is full are silently built there, out of
+//       line, so the capacity should cover every in-place declaration of the program.
+//       Each type+tag keeps its space, and rebuilds its instance there after a reset
+//       (when the new one fits), so resets do not use the region up; only shutdown()
+//       leaves space behind.  In-place declarations cannot be redeclared.
+//
+// Notes on compile-time bindings:
+//
+//     * Production builds with fixed wiring may bind a type+tag to a concrete class with
+//       DEPINJECT_BIND(), at global scope, before any use of that Factory<>.  get() then
+//       returns a statically allocated concrete object with no run-time checks, and
+//       DepInject::bound<>() returns it as its concrete type, so that calls through it
+//       can be devirtualized.  Defining DEPINJECT_STATIC_WIRING as a quoted header name
+//       includes that "wiring header" at the end of this file, so that every user of
+//       DepInject sees the same bindings.  No declaration of a bound type+tag, in any
+//       form, compiles.
+//
+//     * Bound objects are constructed during dynamic initialization, in no particular
+//       order; they must not be used before main() begins.
+//
+// Notes on metrics:
+//
+//     * Defining DEPINJECT_METRICS (identically in every compilation unit) has each
+//       Builder count get() and get_unique() calls, builder invocations and failures,
+//       and keep a histogram of builder latencies; metrics_snapshot() reports them for
+//       every declared type+tag.  Otherwise none of this is compiled.
+//
+// Notes on build tracing:
+//
+//     * Between start_build_trace() and stop_build_trace(), every builder invocation is
+//       recorded: its type+tag, thread, start and end, and the invocation (if any) whose
+//       builder called get() to cause it.  The BuildTrace returned reports the chain of
+//       nested builds that took longest, and exports itself as Chrome trace-event JSON
+//       or as a Graphviz DOT graph of which type+tags' builders needed which.
+//
+//     * Retrieving an instance already built invokes no builder, and is not recorded.
+//       Outside a trace, each builder invocation pays one relaxed load; within one, a
+//       lock and a clock reading at each end.  A trace grows without bound while on:
+//       it is meant for startup, not for a running program's unique instances.
+//
+// Notes on prewarming:
+//
+//     * Every declared Builder enrolls itself in a global registry.  prewarm() walks the
+//       registry and builds all declared shared instances not yet built, so that no
+//       caller pays for construction on its first get().
+//
+//     * A Factory<> whose builder retrieves other dependencies may declare so with
+//       depends_on<>().  The declared edges form a graph, kept acyclic as edges are
+//       added; prewarm() builds dependencies before their dependents, and independent
+//       branches concurrently on a work-stealing thread pool.
+//
+// Notes on asynchronous building:
+//
+//     * A shared instance slow to build may be built on a background thread pool, as
+//       soon as declare_async() declares it or get_async() first asks for it.
+//       get_async() returns a std::shared_future of the instance; get() waits only if
+//       the background build has begun and not yet finished, and, if it has not
+//       begun, builds the instance itself.  Either way the instance is built once.
+//
+//     * A Builder's destruction waits for its background builds to finish.
+//
+// Notes on keyed declarations:
+//
+//     * declare_keyed<Key>() declares one shared instance per run-time key, for any Key
+//       with std::hash<> and operator==.  get(key) builds a key's instance on its first
+//       use and returns it ever after; keys are spread over 64 independently locked
+//       shards, and a key already built is found without taking any lock or Pin.
+//
+//     * Instances live until shutdown() or the Factory's own destruction; a key is
+//       never forgotten.  Given 'max_keys', get() of a new key beyond that many fails
+//       with Error::key_limit rather than grow without bound.
+//
+//     * A keyed builder may not get() from its own keyed declaration, not even for
+//       another key: that is refused as a dependency cycle.
+//
+//     * Keyed declarations are cleared by testing_reset_all(), not testing_reset(), and
+//       are never abandoned by a fast-exit shutdown().
+//
+// Notes on shutdown:
+//
+//     * Common instances otherwise die with their Builders, during static destruction,
+//       in no useful order.  shutdown() destroys them beforehand: in reverse build order,
+//       or, given threads, each once all that may use it are gone.  An instance may use
+//       what it depends_on(), what its builder built or waited for, and anything built
+//       before its own build began.
+//       A fast-exit shutdown skips instances marked with mark_abandonable().
+//
+// Notes on thread safety:
+//
+//     * Declarations are setup code: they must happen-before any get() of the same
+//       type+tag from another thread.
+//
+//     * Shared (non-unique) instances are built exactly once, even when several threads
+//       race on the first get().  Construction is serialized per type+tag; once the
+//       instance is published, get() is a single acquire load of its pointer.
+//
+//     * Builders of unique instances may run concurrently, so a builder is always
+//       called as const; a callable that mutates its captures will not compile.
+//
+// Notes on testing:
+//
+//     * Factory<>::testing_reset() clears one type+tag's declaration and instances;
+//       testing_reset_all() clears every Factory<>'s by starting a new "generation" and
+//       unpublishing each instance, so that the next get() takes the slow path.  There
+//       each Builder notices that it is of an earlier generation, and only then clears
+//       itself.
+//
+// Notes on redeclaration:
+//
+//     * A shared declaration may be replaced with redeclare() while other threads go on
+//       calling get().  An instance already built is replaced at once by one from the
+//       new builder; get() returns either, never anything else.
+//
+//     * The replaced instance is destroyed only once no thread can still be using it:
+//       a thread that retrieves shared instances while holding a DepInject::Pin may use
+//       them until the Pin ends.  get() itself takes no Pin, so anything holding on to
+//       a pointer or reference beyond one (as a Lamp holds its IBulb&) must not be given
+//       a dependency that is ever redeclared: its instance would be freed beneath it.
+//       redeclare() refuses where it can tell, when the builder of a shared instance
+//       still built has built or waited for the one being replaced.
+//
+// Notes on explicit instantiation:
+//
+//     * Every compilation unit using a Factory<> otherwise instantiates it, and its
+//       Builder, for itself.  Instead, DEPINJECT_INSTANTIATE_FACTORY() may instantiate a
+//       type+tag's once, in one .cc file, and DEPINJECT_EXTERN_FACTORY() declare as much
+//       to every other compilation unit that includes this file.
+//
+//     * Code that only retrieves dependencies need not include this file at all:
+//       depinject_fwd.h declares free get<>(), get_unique<>() and get_unique_ptr<>()
+//       functions for such instantiated type+tags.
+//
+// Notes on lazy retrieval:
+//
+//     * A Lazy<Dep, Tag> member (see depinject_fwd.h) defers get() until it is first
+//       used, so that constructing its owner builds nothing.  Once resolved, it holds
+//       on to the instance as a reference member would; it must not be given a
+//       thread-local or scoped declaration, or one that is ever redeclared.
+//
+// Notes on error handling:
+//
+//     * get() and the declaration functions report misuse by throwing std::logic_error,
+//       and a builder's returning nullptr by throwing std::runtime_error.  The throws are
+//       kept out of line, so that they cost the paths that may take them nothing.
+//
+//     * try_get() and try_get_unique() are noexcept: they return a Result holding the
+//       instance or, failing that, an Error saying why.  A builder's exception is caught
+//       and reported as Error::build_threw.
+//
+//     * Compiled without exceptions (-fno-exceptions), DepInject prints the message it
+//       would have thrown and aborts.  try_get() and try_get_unique() then fail softly,
+//       as ever; builders must not throw.
+//
+// Notes on builders:
+//
+//     * A builder may be any callable returning a Dep*, including a lambda that captures
+//       its configuration.  It is copied into fixed storage inside the Builder, never
+//       onto the heap; one larger than DEPINJECT_BUILDER_CAPACITY bytes is refused at
+//       compile time.  basic_declaration<>() and friends forward constructor arguments
+//       the same way.
+//
+// Notes on config-driven wiring:
+//
+//     * Wiring maps names to interface+tag "slots" and to implementations of those
+//       interfaces, so that wire("bulb", "GaudyBulb"), or a configuration file of such
+//       pairs, declares a Factory<> without code naming both types.  Names are hashed
+//       with FNV-1a (at compile time, for literals) and found in flat open-addressed
+//       tables; no RTTI is used, and looking a name up allocates nothing.
+//
+//     * Wiring is setup code, like any declaration.
+
+#ifndef NOON_DEPINJECT_H
+#define NOON_DEPINJECT_H
+
+#include "depinject_fwd.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Bytes of inline storage for a builder callable and its captures.
+#ifndef DEPINJECT_BUILDER_CAPACITY
+#define DEPINJECT_BUILDER_CAPACITY 64
+#endif
+
+// Bytes of static storage for shared instances declared in place, before any spill to
+// the heap (see "Notes on in-place instances").
+#ifndef DEPINJECT_INPLACE_CAPACITY
+#define DEPINJECT_INPLACE_CAPACITY 16384
+#endif
+
+#if DEPINJECT_EXCEPTIONS
+#define DEPINJECT_TRY       try
+#define DEPINJECT_CATCH_ALL catch (...)
+#define DEPINJECT_RETHROW   throw
+#else
+#define DEPINJECT_TRY       if (true)
+#define DEPINJECT_CATCH_ALL else
+#define DEPINJECT_RETHROW   static_cast<void>(0)
+#endif
+
+namespace DepInject
+{
+  //
+  //  Why try_get() or try_get_unique() returned no instance.
+  //
+  enum class Error {
+    none,
+    not_declared,         // the type+tag has no declaration
+    unique_mismatch,      // get_unique() of a non-unique declaration
+    shared_mismatch,      // get() of a unique declaration
+    allocation_failed,    // the builder returned nullptr
+    dependency_cycle,     // requested while being built
+    after_shutdown,       // a shared instance requested after shutdown()
+    outside_scope,        // a scoped instance requested outside any Scope
+    build_threw,          // the builder, or DepInject, threw an exception
+    key_limit             // a keyed declaration already serves its limit of keys
+  };
+
+  // The message get() would throw for 'err'.
+  inline char const* describe (Error err) noexcept {
+    switch (err) {
+    case Error::none:              return "DepInject: no error";
+    case Error::not_declared:      return "DepInject: get: object type+tag not declared";
+    case Error::unique_mismatch:   return "DepInject: get: request for unique instance "
+                                          "doesn't match declaration";
+    case Error::shared_mismatch:   return "DepInject: get: request for non-unique instance "
+                                          "doesn't match declaration";
+    case Error::allocation_failed: return "DepInject: get: object allocation failed";
+    case Error::dependency_cycle:  return "DepInject: get: dependency cycle detected";
+    case Error::after_shutdown:    return "DepInject: get: shared instance requested after shutdown";
+    case Error::outside_scope:     return "DepInject: get: scoped instance requested outside any Scope";
+    case Error::build_threw:       return "DepInject: get: exception thrown while building";
+    case Error::key_limit:         return "DepInject: get: keyed declaration's limit of keys reached";
+    }
+    return "DepInject: unknown error";
+  }
+
+
+  //
+  //  The outcome of try_get() or try_get_unique(): an instance, or the Error
+  //  explaining its absence.
+  //
+  template <typename Dep>
+  class Result {
+  public:
+    Result (Dep* dep) noexcept : instance(dep) { }
+    Result (Error err) noexcept : err(err) { }
+
+    explicit operator bool ( ) const noexcept { return instance != nullptr; }
+
+    Dep* get ( ) const noexcept { return instance; }
+    Dep& operator* ( ) const noexcept { return *instance; }
+    Dep* operator-> ( ) const noexcept { return instance; }
+
+    Error error ( ) const noexcept { return err; }
+    char const* message ( ) const noexcept { return describe(err); }
+
+  private:
+    Dep*  instance {nullptr};
+    Error err      {Error::none};
+  };
+
+
+  namespace Internals
+  {
+    //
+    //  Report a failure (see fail<E>(char const*), in depinject_fwd.h, which the
+    //  example code shares).
+    //
+    template <typename E>
+    [[noreturn]] DEPINJECT_COLD void fail (std::string const& what) {
+      fail<E>(what.c_str());
+    }
+
+    [[noreturn]] inline DEPINJECT_COLD void fail (Error err) {
+      if (err == Error::allocation_failed)
+        fail<std::runtime_error>(describe(err));
+      fail<std::logic_error>(describe(err));
+    }
+
+    //
+    //  How long a built dependency lives, and who owns it.
+    //
+    enum class Lifetime {
+      shared,     // one common instance, owned by DepInject
+      unique,     // a new instance per request, owned by the caller
+      pooled,     // as unique, but released instances are recycled
+      per_thread, // one instance per thread, owned by DepInject
+      per_cpu,    // one instance per CPU, owned by DepInject
+      scoped      // one instance per Scope, owned by the Scope
+    };
+
+    inline bool is_unique (Lifetime lifetime) {
+      return lifetime == Lifetime::unique || lifetime == Lifetime::pooled;
+    }
+
+
+    //
+    //  A callable stored inline, in the manner of std::function but never allocating.
+    //  Callables too large for the storage are refused at compile time.
+    //
+    template <typename Signature>
+    class InlineFunction;
+
+    template <typename R, typename... Args>
+    class InlineFunction<R(Args...)> {
+    public:
+      static constexpr std::size_t capacity = DEPINJECT_BUILDER_CAPACITY;
+
+      InlineFunction() = default;
+      InlineFunction(std::nullptr_t) { }
+
+      template <typename Func,
+                typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<Func>::type, InlineFunction>::value>::type>
+      InlineFunction (Func&& func) {
+        using Stored = typename std::decay<Func>::type;
+        static_assert(sizeof(Stored) <= capacity,
+                      "DepInject: builder too large for inline storage; "
+                      "raise DEPINJECT_BUILDER_CAPACITY");
+        static_assert(alignof(Stored) <= alignof(std::max_align_t),
+                      "DepInject: builder over-aligned for inline storage");
+        if (is_null(func))
+          return;
+        new (storage) Stored(std::forward<Func>(func));
+        call = &invoke<Stored>;
+        ops  = &operations<Stored>;
+      }
+
+      InlineFunction (InlineFunction const& other) {
+        copy_from(other);
+      }
+
+      InlineFunction& operator= (InlineFunction const& other) {
+        if (this != &other) {
+          clear();
+          copy_from(other);
+        }
+        return *this;
+      }
+
+      ~InlineFunction ( ) {
+        clear();
+      }
+
+      explicit operator bool ( ) const { return call != nullptr; }
+
+      R operator() (Args... args) const {
+        return call(storage, std::forward<Args>(args)...);
+      }
+
+    private:
+      struct Ops {
+        void (*copy)(void* to, void const* from);
+        void (*destroy)(void* where);
+      };
+
+      template <typename Stored>
+      static R invoke (void const* where, Args... args) {
+        return (*static_cast<Stored const*>(where))(std::forward<Args>(args)...);
+      }
+
+      template <typename Stored>
+      static Ops const operations;
+
+      template <typename T>
+      static bool is_null (T const&) { return false; }
+      template <typename T>
+      static bool is_null (T* const& func) { return func == nullptr; }
+
+      void copy_from (InlineFunction const& other) {
+        if (other.call) {
+          other.ops->copy(storage, other.storage);
+          call = other.call;
+          ops  = other.ops;
+        }
+      }
+
+      void clear ( ) {
+        if (call) {
+          ops->destroy(storage);
+          call = nullptr;
+          ops  = nullptr;
+        }
+      }
+
+      alignas(std::max_align_t) unsigned char storage[capacity];
+      R          (*call)(void const*, Args...) {nullptr};
+      Ops const* ops                           {nullptr};
+    };
+
+    template <typename R, typename... Args>
+    template <typename Stored>
+    typename InlineFunction<R(Args...)>::Ops const InlineFunction<R(Args...)>::operations = {
+      [](void* to, void const* from) { new (to) Stored(*static_cast<Stored const*>(from)); },
+      [](void* where) { static_cast<Stored*>(where)->~Stored(); }
+    };
+
+
+    //
+    //  A builder constructing Concrete from stored copies of constructor arguments,
+    //  either on the heap or in place.
+    //
+    template <typename Dep, typename Concrete, typename... Args>
+    class ConstructWith {
+    public:
+      template <typename... Given>
+      explicit ConstructWith (Given&&... given) : args(std::forward<Given>(given)...) { }
+
+      Dep* operator() ( ) const {
+        return construct(nullptr, std::index_sequence_for<Args...>());
+      }
+
+      Dep* operator() (void* where) const {
+        return construct(where, std::index_sequence_for<Args...>());
+      }
+
+    private:
+      template <std::size_t... I>
+      Dep* construct (void* where, std::index_sequence<I...>) const {
+        if (where)
+          return new (where) Concrete(std::get<I>(args)...);
+        return new Concrete(std::get<I>(args)...);
+      }
+
+      std::tuple<Args...> args;
+    };
+
+    template <typename Dep, typename Concrete, typename... Args>
+    ConstructWith<Dep, Concrete, typename std::decay<Args>::type...>
+    construct_with (Args&&... args) {
+      return ConstructWith<Dep, Concrete, typename std::decay<Args>::type...>(
+        std::forward<Args>(args)...);
+    }
+
+
+    //
+    //  How to construct a declared concrete class in storage provided by DepInject.
+    //  Only declarations naming their concrete class carry a Placement.
+    //
+    template <typename Dep>
+    struct Placement {
+      std::size_t                 size  {0};
+      std::size_t                 align {0};
+      InlineFunction<Dep*(void*)> construct;
+      void                        (*destroy)(void* where) {nullptr};
+
+      explicit operator bool ( ) const { return static_cast<bool>(construct); }
+
+      template <typename Concrete, typename... Args>
+      static Placement of (Args&&... args) {
+        Placement p;
+        p.size      = sizeof(Concrete);
+        p.align     = alignof(Concrete);
+        p.construct = construct_with<Dep, Concrete>(std::forward<Args>(args)...);
+        p.destroy   = [](void* where) { static_cast<Concrete*>(where)->~Concrete(); };
+        return p;
+      }
+    };
+
+
+    //
+    //  A block of unique instances built together by get_unique_n(), laid out side
+    //  by side from a cache-line boundary.  Each instance is destroyed as its handle
+    //  releases it; the block is freed along with the last.
+    //
+    template <typename Dep>
+    class Batch {
+    public:
+      static constexpr std::size_t cache_line = 64;
+
+      // Allocate room for 'n' instances of the placement's concrete class.
+      static Batch* create (Placement<Dep> const& placement, std::size_t n) {
+        std::size_t align  = placement.align > cache_line ? placement.align : cache_line;
+        std::size_t stride = (placement.size + placement.align - 1) / placement.align
+                             * placement.align;
+        void*       raw    = ::operator new(sizeof(Batch) + align - 1 + n * stride);
+        return new (raw) Batch(raw, align, stride, n, placement.destroy);
+      }
+
+      void* slot (std::size_t index) const {
+        return first + index * stride;
+      }
+
+      // Disposer<Dep> function: 'cookie' is the instance's index in the block.
+      static void release (Dep*, void* context, std::uintptr_t cookie) {
+        auto batch = static_cast<Batch*>(context);
+        batch->destroy(batch->slot(cookie));
+        batch->drop(1);
+      }
+
+      // Give up 'count' slots, freeing the block along with the last.
+      void drop (std::size_t count) {
+        if (live.fetch_sub(count, std::memory_order_acq_rel) == count) {
+          void* block = raw;
+          this->~Batch();
+          ::operator delete(block);
+        }
+      }
+
+    private:
+      Batch (void* mem, std::size_t align, std::size_t size, std::size_t n,
+             void (*dtor)(void*))
+        : raw(mem), stride(size), destroy(dtor), live(n) {
+        auto start = reinterpret_cast<std::uintptr_t>(mem) + sizeof(Batch);
+        first = reinterpret_cast<char*>((start + align - 1) / align * align);
+      }
+
+      void*                    raw;
+      char*                    first {nullptr};
+      std::size_t              stride;
+      void                     (*destroy)(void*);
+      std::atomic<std::size_t> live;
+    };
+
+
+    //
+    //  The CPU the calling thread is running on.  Where that cannot be asked, a
+    //  number fixed for the thread, handed out round-robin, stands in for it.
+    //
+    inline unsigned current_cpu ( ) noexcept {
+#if defined(__linux__)
+      int cpu = sched_getcpu();
+      if (cpu >= 0)
+        return static_cast<unsigned>(cpu);
+#endif
+      static std::atomic<unsigned> next {0};
+      static thread_local unsigned mine = next.fetch_add(1, std::memory_order_relaxed);
+      return mine;
+    }
+
+
+    //
+    //  The instances of a per-CPU declaration, one per CPU, side by side in a single
+    //  allocation.  Each starts on a cache-line boundary and is padded out to one,
+    //  so that no two CPUs' instances share a line.  (Aligned by hand, as C++14's
+    //  operator new promises no more than alignof(std::max_align_t).)
+    //
+    template <typename Dep>
+    class CpuShards {
+    public:
+      static constexpr std::size_t cache_line = 64;
+
+      CpuShards (Placement<Dep> const& placement, std::size_t n)
+        : deps(new Dep*[n]), count(n), destroy(placement.destroy) {
+        std::size_t align = placement.align > cache_line ? placement.align : cache_line;
+        stride = (placement.size + align - 1) / align * align;
+        raw    = ::operator new(align - 1 + n * stride);
+        auto start = reinterpret_cast<std::uintptr_t>(raw);
+        first  = reinterpret_cast<char*>((start + align - 1) / align * align);
+      }
+
+      ~CpuShards ( ) {
+        for (std::size_t i = built; i > 0; --i)
+          destroy(slot(i - 1));
+        ::operator delete(raw);
+      }
+
+      CpuShards(CpuShards const&) = delete;
+      CpuShards& operator=(CpuShards const&) = delete;
+
+      // The CPUs served: as many as the hardware reports.  Should a thread be running
+      // on a CPU numbered beyond them, it shares another CPU's instance.
+      static std::size_t cpus ( ) {
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+      }
+
+      // Construct every CPU's instance in its slot with 'make'.  Those built are
+      // destroyed along with the shards should 'make' fail.
+      template <typename Make>
+      bool build (Make make) {
+        for (; built < count; ++built) {
+          deps[built] = make(slot(built));
+          if (!deps[built])
+            return false;
+        }
+        return true;
+      }
+
+      Dep* local ( ) const noexcept {
+        std::size_t cpu = current_cpu();
+        return deps[cpu < count ? cpu : cpu % count];
+      }
+
+      template <typename Func>
+      void visit (Func& f) const {
+        for (std::size_t i = 0; i < count; ++i)
+          f(*deps[i]);
+      }
+
+    private:
+      void* slot (std::size_t index) const {
+        return first + index * stride;
+      }
+
+      std::unique_ptr<Dep*[]> deps;
+      std::size_t             count;
+      std::size_t             built {0};
+      void                    (*destroy)(void*);
+      void*                   raw;
+      char*                   first;
+      std::size_t             stride;
+    };
+
+
+    //
+    //  Everything a Factory<> tells its Builder in a declaration.
+    //
+    template <typename Dep>
+    struct Declaration {
+      InlineFunction<Dep*()> builder;
+      Lifetime       lifetime        {Lifetime::shared};
+      void           (*reset)(Dep&)  {nullptr};   // pooled: restore a released instance
+      std::size_t    max_idle        {0};         // pooled: limit on the common pool
+      Placement<Dep> placement;                   // scoped, per-CPU: construction in place
+    };
+
+
+    //
+    //  A monotonic arena: allocation is a pointer bump, and everything allocated is
+    //  freed together.  It starts in a caller-supplied buffer and continues in
+    //  heap blocks of doubling size.
+    //
+    class MonotonicArena {
+    public:
+      MonotonicArena (void* buffer, std::size_t size)
+        : initial(static_cast<char*>(buffer)), initial_size(size),
+          cursor(initial), end(initial + size), next_size(size ? 2 * size : 1024) { }
+
+      ~MonotonicArena ( ) {
+        release();
+      }
+
+      MonotonicArena(MonotonicArena const&) = delete;
+      MonotonicArena& operator=(MonotonicArena const&) = delete;
+
+      void* allocate (std::size_t size, std::size_t align) {
+        char* where = align_up(cursor, align);
+        if (where > end || size > static_cast<std::size_t>(end - where)) {
+          grow(size + align);
+          where = align_up(cursor, align);
+        }
+        cursor = where + size;
+        return where;
+      }
+
+      // Free every heap block, and start over in the initial buffer.
+      void release ( ) {
+        while (blocks) {
+          Block* next = blocks->next;
+          ::operator delete(blocks);
+          blocks = next;
+        }
+        cursor    = initial;
+        end       = initial + initial_size;
+        next_size = initial_size ? 2 * initial_size : 1024;
+      }
+
+    private:
+      struct Block {
+        Block* next;
+      };
+
+      static char* align_up (char* p, std::size_t align) {
+        auto n = reinterpret_cast<std::uintptr_t>(p);
+        return p + ((align - n % align) % align);
+      }
+
+      void grow (std::size_t at_least) {
+        std::size_t size = next_size;
+        while (size < at_least)
+          size *= 2;
+        next_size = 2 * size;
+        auto block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+        block->next = blocks;
+        blocks      = block;
+        cursor      = reinterpret_cast<char*>(block + 1);
+        end         = cursor + size;
+      }
+
+      char*       initial;
+      std::size_t initial_size;
+      char*       cursor;
+      char*       end;
+      std::size_t next_size;
+      Block*      blocks {nullptr};
+    };
+
+
+    //
+    //  The storage of shared instances declared in place: one static, cache-line
+    //  aligned region, handed out in build order at each instance's own alignment,
+    //  so that the instances lie side by side.  Once it is full, the region goes on
+    //  in heap blocks.  Space is never returned: each Builder keeps its own to reuse.
+    //  Nor is the region destroyed, as in-place instances may outlive any other
+    //  static.  (A class template's static members, so that the buffer can be defined
+    //  in a header.)
+    //
+    template <typename = void>
+    class InplaceRegion {
+    public:
+      static void* allocate (std::size_t size, std::size_t align) {
+        static State* state = new State;
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->arena.allocate(size, align);
+      }
+
+      // Whether 'p' lies in the static region, rather than a heap block.
+      static bool contains (void const* p) {
+        auto at = static_cast<char const*>(p);
+        return at >= buffer && at < buffer + sizeof(buffer);
+      }
+
+    private:
+      struct State {
+        std::mutex     mutex;
+        MonotonicArena arena {buffer, sizeof(buffer)};
+      };
+
+      alignas(64) static char buffer[DEPINJECT_INPLACE_CAPACITY];
+    };
+
+    template <typename T>
+    alignas(64) char InplaceRegion<T>::buffer[DEPINJECT_INPLACE_CAPACITY];
+
+
+    //
+    //  The deleter of a common instance: one built in place is destroyed there,
+    //  any other deleted.
+    //
+    template <typename Dep>
+    struct InstanceDeleter {
+      void  (*destroy)(void* where) {nullptr};    // in place: the concrete destructor
+      void* where {nullptr};
+
+      void operator() (Dep* dep) const {
+        if (destroy)
+          destroy(where);
+        else
+          delete dep;
+      }
+    };
+
+
+    //
+    //  The readable name of a type, without RTTI, parsed from the compiler's
+    //  decorated name of type_name<T>().
+    //
+    inline std::string parse_type_name (std::string const& pretty) {
+#if defined(__clang__) || defined(__GNUC__)
+      // "... type_name() [T = Name]" or "... type_name() [with T = Name; ...]"
+      auto begin = pretty.find("T = ");
+      if (begin == std::string::npos)
+        return pretty;
+      begin += 4;
+      auto end = pretty.find_first_of(";]", begin);
+      return pretty.substr(begin, end - begin);
+#elif defined(_MSC_VER)
+      // "... type_name<class Name>(void)"
+      auto begin = pretty.find("type_name<");
+      auto end   = pretty.rfind(">(void)");
+      if (begin == std::string::npos || end == std::string::npos)
+        return pretty;
+      begin += 10;
+      for (std::string kind : {"class ", "struct ", "enum "}) {
+        if (pretty.compare(begin, kind.size(), kind) == 0)
+          begin += kind.size();
+      }
+      return pretty.substr(begin, end - begin);
+#else
+      return pretty;
+#endif
+    }
+
+    template <typename T>
+    std::string const& type_name ( ) {
+#if defined(__clang__) || defined(__GNUC__)
+      static std::string const name = parse_type_name(__PRETTY_FUNCTION__);
+#elif defined(_MSC_VER)
+      static std::string const name = parse_type_name(__FUNCSIG__);
+#else
+      static std::string const name = "?";
+#endif
+      return name;
+    }
+
+
+#ifdef DEPINJECT_METRICS
+    //
+    //  Counter slots owned by one thread at a time, so that a thread can count with a
+    //  plain load and store rather than an atomic read-modify-write.  A thread takes a
+    //  slot on first use and frees it on exit; should every slot be taken, it shares
+    //  the extra "overflow" slot, numbered 'count', with atomic increments.
+    //
+    class ThreadSlots {
+    public:
+      static constexpr std::size_t count = 64;
+
+      // The calling thread's slot.
+      static std::size_t mine ( ) {
+        std::size_t& slot = held();           // zero, or the slot plus one
+        if (!slot)
+          slot = take() + 1;
+        return slot - 1;
+      }
+
+    private:
+      static std::size_t& held ( ) {
+        static thread_local std::size_t slot {0};
+        return slot;
+      }
+
+      struct Pool {
+        std::mutex               mutex;
+        std::vector<std::size_t> free;
+
+        Pool ( ) {
+          for (std::size_t i = count; i > 0; --i)
+            free.push_back(i - 1);
+        }
+      };
+
+      static Pool& pool ( ) {
+        static Pool p;
+        return p;
+      }
+
+      struct Releaser {
+        std::size_t slot;
+
+        ~Releaser ( ) {
+          Pool& p = pool();
+          std::lock_guard<std::mutex> lock(p.mutex);
+          p.free.push_back(slot);
+          held() = 0;
+        }
+      };
+
+      static std::size_t take ( ) {
+        Pool& p = pool();
+        std::size_t slot = count;
+        {
+          std::lock_guard<std::mutex> lock(p.mutex);
+          if (!p.free.empty()) {
+            slot = p.free.back();
+            p.free.pop_back();
+          }
+        }
+        if (slot != count)
+          static thread_local Releaser releaser {slot};
+        return slot;
+      }
+    };
+
+
+    //
+    //  A Builder's instrumentation.  Build latencies are kept in power-of-two buckets:
+    //  bucket i counts builds taking [2^i, 2^(i+1)) ns, the first and last buckets also
+    //  counting anything faster or slower.
+    //
+    class Metrics {
+    public:
+      static constexpr std::size_t latency_buckets = 40;
+
+      void count_get (bool uniq, std::uint64_t count = 1) {
+        std::size_t                 slot = ThreadSlots::mine();
+        std::atomic<std::uint64_t>& n    = uniq ? calls[slot].unique_gets : calls[slot].gets;
+        if (slot != ThreadSlots::count)
+          n.store(n.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        else
+          n.fetch_add(count, std::memory_order_relaxed);
+      }
+
+      std::uint64_t total_gets (bool uniq) const {
+        std::uint64_t sum = 0;
+        for (auto const& c : calls)
+          sum += (uniq ? c.unique_gets : c.gets).load(std::memory_order_relaxed);
+        return sum;
+      }
+
+      void count_build (std::chrono::nanoseconds elapsed, bool failed) {
+        builds.fetch_add(1, std::memory_order_relaxed);
+        if (failed)
+          failures.fetch_add(1, std::memory_order_relaxed);
+        std::size_t bucket = 0;
+        for (auto ns = elapsed.count(); ns > 1 && bucket + 1 < latency_buckets; ns >>= 1)
+          ++bucket;
+        latency[bucket].fetch_add(1, std::memory_order_relaxed);
+      }
+
+      struct alignas(64) Calls {
+        std::atomic<std::uint64_t> gets        {0};
+        std::atomic<std::uint64_t> unique_gets {0};
+      };
+
+      Calls                      calls[ThreadSlots::count + 1];
+      std::atomic<std::uint64_t> builds   {0};
+      std::atomic<std::uint64_t> failures {0};
+      std::atomic<std::uint64_t> latency[latency_buckets] {};
+    };
+#endif
+
+
+    //
+    //  The generation of every Builder's state.  testing_reset_all() starts a new one,
+    //  and unpublishes each Builder's instances; a Builder finding itself in an earlier
+    //  generation on its next slow-path use resets itself first.  (A class template's
+    //  static member, so that it is constant-initialized and read with no guard.)
+    //
+    template <typename = void>
+    struct Generation {
+      static std::atomic<std::uint64_t> current;
+    };
+
+    template <typename T>
+    std::atomic<std::uint64_t> Generation<T>::current {0};
+
+
+    //
+    //  The type-erased face of a Builder, for operations over all declared dependencies.
+    //
+    class BuilderBase {
+    public:
+      // Build the common instance now, if declared shared and not yet built.  Returns
+      // whether it was built here, and if so how long that took.
+      virtual bool prewarm (std::chrono::nanoseconds& elapsed) = 0;
+
+      // When the common instance was built, as a registry build stamp, or zero if
+      // it is not built.
+      virtual std::uint64_t built_at ( ) = 0;
+
+      // When the build of the common instance began, as a registry build stamp, or
+      // zero if it is not built.
+      virtual std::uint64_t began_at ( ) = 0;
+
+      // Withdraw whatever get()'s fast path would return, for testing_reset_all(), so
+      // that the next get() takes the slow path and there finds a new generation.
+      virtual void unpublish ( ) = 0;
+
+      // Destroy the common instance and idle pooled instances, and refuse to build
+      // the common instance again.  With 'fast', an instance marked abandonable is
+      // forgotten instead of destroyed.  Returns whether an instance was destroyed.
+      virtual bool shut_down (bool fast) = 0;
+
+      virtual std::string const& dependency_name ( ) const = 0;
+      virtual std::string const& tag_name ( ) const = 0;
+
+#ifdef DEPINJECT_METRICS
+      Metrics metrics;
+#endif
+
+    protected:
+      ~BuilderBase() = default;
+
+    private:
+      friend class Registry;
+
+      // Guarded by the Registry's mutex.
+      bool                      enrolled {false};
+      std::vector<BuilderBase*> dependencies;     // declared by depends_on()...
+      std::uint64_t             edges_generation {0};   // ...in this generation
+      std::vector<BuilderBase*> used;             // retrieved by the builder function...
+      std::uint64_t             used_generation {0};    // ...in this generation
+    };
+
+
+    //
+    //  The registry of every Builder that has ever been declared, and of the
+    //  dependencies declared between them.  (Builders are function-local statics,
+    //  so entries never dangle before exit.)
+    //
+    class Registry {
+    public:
+      // A snapshot of the dependency graph, with Builders indexed as in 'nodes'.
+      struct Graph {
+        std::vector<BuilderBase*>              nodes;
+        std::vector<std::vector<std::size_t>>  dependencies;   // edges
+        std::vector<std::vector<std::size_t>>  dependents;     // edges reversed
+        std::vector<std::size_t>               dependency_count;
+        std::vector<std::vector<std::size_t>>  used;           // seen while building
+
+        // Add the edge 'from' -> 'to', unless it is there already or would close a
+        // cycle.  Returns whether it was added.
+        bool add (std::size_t from, std::size_t to) {
+          std::vector<std::size_t> stack {to};
+          std::vector<bool>        seen(nodes.size());
+          while (!stack.empty()) {
+            std::size_t node = stack.back();
+            stack.pop_back();
+            if (node == from)
+              return false;
+            for (std::size_t next : dependencies[node]) {
+              if (!seen[next]) {
+                seen[next] = true;
+                stack.push_back(next);
+              }
+            }
+          }
+          for (std::size_t d : dependencies[from]) {
+            if (d == to)
+              return false;
+          }
+          dependencies[from].push_back(to);
+          dependents[to].push_back(from);
+          ++dependency_count[from];
+          return true;
+        }
+      };
+
+      void enroll (BuilderBase* builder) {
+        std::lock_guard<std::mutex> lock(mutex);
+        enroll_locked(builder);
+      }
+
+      // Record that 'from' depends on 'to', refusing any edge that closes a cycle.
+      void depend (BuilderBase* from, BuilderBase* to) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (from == to || reaches(to, from))
+          fail<std::logic_error>("DepInject: depends_on: dependency cycle detected");
+        enroll_locked(from);
+        enroll_locked(to);
+        std::uint64_t now = Generation<>::current.load(std::memory_order_relaxed);
+        if (from->edges_generation != now) {
+          from->dependencies.clear();
+          from->edges_generation = now;
+        }
+        for (BuilderBase* dep : from->dependencies) {
+          if (dep == to)
+            return;
+        }
+        from->dependencies.push_back(to);
+      }
+
+      // Record that 'from''s builder function retrieved 'to''s shared instance.
+      void use (BuilderBase* from, BuilderBase* to) {
+        std::lock_guard<std::mutex> lock(mutex);
+        enroll_locked(from);
+        enroll_locked(to);
+        std::uint64_t now = Generation<>::current.load(std::memory_order_relaxed);
+        if (from->used_generation != now) {
+          from->used.clear();
+          from->used_generation = now;
+        }
+        for (BuilderBase* dep : from->used) {
+          if (dep == to)
+            return;
+        }
+        from->used.push_back(to);
+      }
+
+      // The Builders whose builder functions have retrieved 'builder''s shared
+      // instance in this generation.
+      std::vector<BuilderBase*> users (BuilderBase const* builder) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::uint64_t             now = Generation<>::current.load(std::memory_order_relaxed);
+        std::vector<BuilderBase*> found;
+        for (BuilderBase* b : builders) {
+          if (b->used_generation == now &&
+              std::find(b->used.begin(), b->used.end(), builder) != b->used.end())
+            found.push_back(b);
+        }
+        return found;
+      }
+
+      void forget_dependencies (BuilderBase* builder) {
+        std::lock_guard<std::mutex> lock(mutex);
+        builder->dependencies.clear();
+        builder->used.clear();
+      }
+
+      std::vector<BuilderBase*> snapshot ( ) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return builders;
+      }
+
+      Graph graph ( ) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Graph g;
+        g.nodes = builders;
+        g.dependencies.resize(builders.size());
+        g.dependents.resize(builders.size());
+        g.dependency_count.resize(builders.size());
+        g.used.resize(builders.size());
+        std::uint64_t now = Generation<>::current.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < builders.size(); ++i) {
+          for (BuilderBase* dep : edges(builders[i])) {
+            std::size_t d = index_of(dep);
+            g.dependencies[i].push_back(d);
+            g.dependents[d].push_back(i);
+            ++g.dependency_count[i];
+          }
+          if (builders[i]->used_generation == now) {
+            for (BuilderBase* dep : builders[i]->used)
+              g.used[i].push_back(index_of(dep));
+          }
+        }
+        return g;
+      }
+
+      // A stamp for a common instance newly built, or whose build is beginning,
+      // later than any before it.
+      std::uint64_t next_build_stamp ( ) {
+        return build_stamps.fetch_add(1, std::memory_order_relaxed) + 1;
+      }
+
+    private:
+      void enroll_locked (BuilderBase* builder) {
+        if (!builder->enrolled) {
+          builders.push_back(builder);
+          builder->enrolled = true;
+        }
+      }
+
+      // The dependencies of 'builder', unless declared in an earlier generation.
+      static std::vector<BuilderBase*> const& edges (BuilderBase const* builder) {
+        static std::vector<BuilderBase*> const none;
+        if (builder->edges_generation != Generation<>::current.load(std::memory_order_relaxed))
+          return none;
+        return builder->dependencies;
+      }
+
+      bool reaches (BuilderBase* from, BuilderBase* target) const {
+        std::vector<BuilderBase*>        stack {from};
+        std::unordered_set<BuilderBase*> seen  {from};
+        while (!stack.empty()) {
+          BuilderBase* node = stack.back();
+          stack.pop_back();
+          if (node == target)
+            return true;
+          for (BuilderBase* dep : edges(node)) {
+            if (seen.insert(dep).second)
+              stack.push_back(dep);
+          }
+        }
+        return false;
+      }
+
+      std::size_t index_of (BuilderBase* builder) const {
+        std::size_t i = 0;
+        while (builders[i] != builder)
+          ++i;
+        return i;
+      }
+
+      std::mutex                 mutex;
+      std::vector<BuilderBase*>  builders;
+      std::atomic<std::uint64_t> build_stamps {0};
+    };
+
+    inline Registry& registry ( ) {
+      static Registry reg;
+      return reg;
+    }
+
+
+    //
+    //  The recorder of builder invocations while a build trace is active (see
+    //  start_build_trace()).  Each invocation is a record of its Builder, thread,
+    //  start and end, and the invocation it ran within, if any.
+    //
+    class Tracer {
+    public:
+      static constexpr std::size_t none = ~std::size_t(0);
+
+      struct Record {
+        BuilderBase const*                    builder;
+        unsigned                              thread;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+        std::size_t                           parent;
+        bool                                  failed;
+      };
+
+      bool active ( ) const {
+        return on.load(std::memory_order_relaxed);
+      }
+
+      void start ( ) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++session;
+        records.clear();
+        threads.clear();
+        origin = std::chrono::steady_clock::now();
+        on.store(true, std::memory_order_relaxed);
+      }
+
+      // Stop recording, returning the records and the time recording began.
+      std::vector<Record> stop (std::chrono::steady_clock::time_point& began) {
+        std::lock_guard<std::mutex> lock(mutex);
+        on.store(false, std::memory_order_relaxed);
+        ++session;
+        began = origin;
+        return std::move(records);
+      }
+
+      // Begin a record, returning its index (or 'none', if not tracing) and setting
+      // 'trace' to the trace it belongs to.  'parent' is a record of 'parent_trace'.
+      std::size_t begin (BuilderBase const* builder, std::size_t parent,
+                         std::uint64_t parent_trace, std::uint64_t& trace) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!on.load(std::memory_order_relaxed))
+          return none;
+        trace = session;
+        if (parent_trace != session)
+          parent = none;
+        std::thread::id me = std::this_thread::get_id();
+        unsigned thread = 0;
+        while (thread < threads.size() && threads[thread] != me)
+          ++thread;
+        if (thread == threads.size())
+          threads.push_back(me);
+        records.push_back(Record{builder, thread, now, {}, parent, true});
+        return records.size() - 1;
+      }
+
+      void end (std::size_t record, std::uint64_t trace, bool failed) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (trace == session && record < records.size()) {    // else stopped since
+          records[record].end    = now;
+          records[record].failed = failed;
+        }
+      }
+
+    private:
+      std::atomic<bool>                     on {false};
+      std::mutex                            mutex;
+      std::vector<Record>                   records;
+      std::vector<std::thread::id>          threads;        // numbered in order seen
+      std::chrono::steady_clock::time_point origin;
+      std::uint64_t                         session {0};    // traces started
+    };
+
+    inline Tracer& tracer ( ) {
+      static Tracer t;
+      return t;
+    }
+
+
+    //
+    //  The Builders whose builder functions are running on this thread, as a stack of
+    //  BuildScope frames linked innermost first.  A Builder found here again is being
+    //  asked for itself.  A frame building an instance that shutdown() destroys (a
+    //  shared, per-CPU or keyed one) is a recorder: each shared instance built or
+    //  waited for within it, by its builder function or any nested one, is noted in
+    //  the Registry as used by it.  (A get() served from the fast path notes nothing;
+    //  shutdown() orders those by build stamps instead.)  While a build trace is
+    //  active, each frame is also a Tracer record, whose parent is the record of the
+    //  frame outside it.
+    //
+    class BuildScope {
+    public:
+      BuildScope (BuilderBase* b, bool records)
+        : builder(b), outer(top()), recorder(records ? this : outer ? outer->recorder : nullptr) {
+        top() = this;
+        if (tracer().active())
+          record = tracer().begin(b, outer ? outer->record : Tracer::none,
+                                  outer ? outer->trace : 0, trace);
+      }
+
+      ~BuildScope ( ) {
+        top() = outer;
+        if (record != Tracer::none)
+          tracer().end(record, trace, failed);
+      }
+
+      BuildScope(BuildScope const&) = delete;
+      BuildScope& operator=(BuildScope const&) = delete;
+
+      // The builder function returned 'dep'.  (A frame left otherwise, by an
+      // exception, is traced as failed.)
+      void returned (void const* dep) {
+        failed = dep == nullptr;
+      }
+
+      static bool contains (BuilderBase const* b) {
+        for (BuildScope const* s = top(); s; s = s->outer) {
+          if (s->builder == b)
+            return true;
+        }
+        return false;
+      }
+
+      // Note that 'b''s shared instance is being built or waited for, on behalf of
+      // the recorder running on this thread if any.  Called only off the fast path.
+      static void note_use (BuilderBase* b) {
+        BuildScope* s = top();
+        if (s && s->recorder && s->recorder->builder != b)
+          s->recorder->note(b);
+      }
+
+    private:
+      static BuildScope*& top ( ) {
+        static thread_local BuildScope* innermost {nullptr};
+        return innermost;
+      }
+
+      // Record 'b' as used, unless this frame already has.
+      void note (BuilderBase* b) {
+        if (std::find(noted.begin(), noted.end(), b) != noted.end())
+          return;
+        noted.push_back(b);
+        registry().use(builder, b);
+      }
+
+      BuilderBase*              builder;
+      BuildScope*               outer;
+      BuildScope*               recorder;       // this frame or an outer one, or null
+      std::vector<BuilderBase*> noted;          // by a recorder, in the Registry
+      std::size_t               record {Tracer::none};
+      std::uint64_t             trace  {0};
+      bool                      failed {true};
+    };
+
+
+    //
+    //  A work-stealing thread pool.  Each worker runs tasks from the back of its own
+    //  queue, where the tasks it submits go, and steals from the front of the others'
+    //  queues when its own is empty.
+    //
+    class TaskPool {
+    public:
+      using Task = std::function<void()>;
+
+      explicit TaskPool (unsigned nthreads) {
+        if (nthreads == 0)
+          nthreads = 1;
+        for (unsigned i = 0; i < nthreads; ++i)
+          queues.emplace_back(new Queue);
+        for (unsigned i = 0; i < nthreads; ++i)
+          workers.emplace_back([this, i]() { work(i); });
+      }
+
+      ~TaskPool ( ) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers)
+          worker.join();
+      }
+
+      TaskPool(TaskPool const&) = delete;
+      TaskPool& operator=(TaskPool const&) = delete;
+
+      // Queue a task.  Tasks must not throw.
+      void submit (Task task) {
+        std::size_t q = (current_pool() == this) ? current_index()
+                                                 : next_queue++ % queues.size();
+        {
+          std::lock_guard<std::mutex> lock(queues[q]->mutex);
+          queues[q]->tasks.push_back(std::move(task));
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          ++queued;
+          ++pending;
+        }
+        wakeup.notify_one();
+      }
+
+      // Wait until every submitted task, including those submitted by tasks, is done.
+      void wait ( ) {
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [this]() { return pending == 0; });
+      }
+
+    private:
+      struct Queue {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+      };
+
+      static TaskPool*& current_pool ( ) {
+        static thread_local TaskPool* pool {nullptr};
+        return pool;
+      }
+
+      static std::size_t& current_index ( ) {
+        static thread_local std::size_t index {0};
+        return index;
+      }
+
+      void work (std::size_t index) {
+        current_pool()  = this;
+        current_index() = index;
+        for (;;) {
+          {
+            // Claim one queued task, or leave once stopped with nothing queued.
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this]() { return stopping || queued > 0; });
+            if (queued == 0)
+              return;
+            --queued;
+          }
+          Task task;
+          while (!take(index, task))
+            ;
+          task();
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+              drained.notify_all();
+          }
+        }
+      }
+
+      bool take (std::size_t index, Task& task) {
+        {
+          Queue& own = *queues[index];
+          std::lock_guard<std::mutex> lock(own.mutex);
+          if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+          }
+        }
+        for (std::size_t i = 1; i < queues.size(); ++i) {
+          Queue& victim = *queues[(index + i) % queues.size()];
+          std::lock_guard<std::mutex> lock(victim.mutex);
+          if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+          }
+        }
+        return false;
+      }
+
+      std::vector<std::unique_ptr<Queue>> queues;
+      std::vector<std::thread>            workers;
+      std::atomic<std::size_t>            next_queue {0};
+      std::mutex                          mutex;
+      std::condition_variable             wakeup;
+      std::condition_variable             drained;
+      std::size_t                         queued   {0};   // submitted, not yet claimed
+      std::size_t                         pending  {0};   // submitted, not yet finished
+      bool                                stopping {false};
+    };
+
+
+    // The pool on which declare_async() and get_async() build in the background.
+    inline TaskPool& background ( ) {
+      static TaskPool pool(std::max(1u, std::thread::hardware_concurrency()));
+      return pool;
+    }
+
+
+    //
+    //  Visit every node of a graph of 'waiting.size()' nodes, each only once the
+    //  'waiting[i]' nodes naming it in their 'next' lists have been visited; using
+    //  up to 'nthreads' threads, so that nodes not ordered by the graph may be
+    //  visited concurrently.  If any visit throws, the first exception is rethrown
+    //  once the rest of the graph has been visited.
+    //
+    inline void walk_graph (std::vector<std::vector<std::size_t>> const& next,
+                            std::vector<std::size_t> const& waiting,
+                            unsigned nthreads,
+                            std::function<void(std::size_t)> const& visit) {
+      std::size_t        count = waiting.size();
+#if DEPINJECT_EXCEPTIONS
+      std::mutex         mutex;            // guards 'failure'
+      std::exception_ptr failure;
+#endif
+      std::unique_ptr<std::atomic<std::size_t>[]> waiting_on
+        {new std::atomic<std::size_t>[count]};
+      for (std::size_t i = 0; i < count; ++i)
+        waiting_on[i] = waiting[i];
+
+      // Visit one node, then release whichever nodes were waiting only on it.
+      std::function<void(std::size_t)>  step;
+      std::function<void(std::size_t)>  ready;
+      step = [&](std::size_t i) {
+#if DEPINJECT_EXCEPTIONS
+        try {
+          visit(i);
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!failure)
+            failure = std::current_exception();
+        }
+#else
+        visit(i);
+#endif
+        for (std::size_t n : next[i]) {
+          if (waiting_on[n].fetch_sub(1) == 1)
+            ready(n);
+        }
+      };
+
+      if (nthreads <= 1) {
+        ready = step;
+        for (std::size_t i = 0; i < count; ++i) {
+          if (waiting[i] == 0)
+            step(i);
+        }
+      }
+      else {
+        TaskPool pool(nthreads);
+        ready = [&](std::size_t i) { pool.submit([&step, i]() { step(i); }); };
+        for (std::size_t i = 0; i < count; ++i) {
+          if (waiting[i] == 0)
+            ready(i);
+        }
+        pool.wait();
+      }
+
+#if DEPINJECT_EXCEPTIONS
+      if (failure)
+        std::rethrow_exception(failure);
+#endif
+    }
+
+
+    //
+    //  Epoch-based reclamation of redeclared common instances.  A reader pins the
+    //  global epoch while it uses shared instances; a replaced instance is retired
+    //  in the epoch current when it was unpublished, and destroyed once the epoch
+    //  has advanced twice since, by which time no pinned reader can still hold it.
+    //  The epoch advances only when every pinned reader has seen its current value.
+    //
+    class Epochs {
+    public:
+      // One per thread, reused after the thread exits.  Only the owning thread
+      // writes 'pinned' or 'depth'.  Padded so that no two threads' records share
+      // a cache line (plain new need not honour a cache-line alignas).
+      struct Reader {
+        std::atomic<std::uint64_t> pinned {0};    // epoch pinned, or 0 if none
+        std::atomic<bool>          in_use {false};
+        unsigned                   depth  {0};    // nested pins
+        Reader*                    next   {nullptr};
+        char                       padding[64];
+      };
+
+      Epochs() = default;
+      Epochs(Epochs const&) = delete;
+      Epochs& operator=(Epochs const&) = delete;
+
+      ~Epochs ( ) {
+        for (Retired& r : limbo)
+          r.destroy(r.object);
+        while (Reader* r = readers.load(std::memory_order_relaxed)) {
+          readers.store(r->next, std::memory_order_relaxed);
+          delete r;
+        }
+      }
+
+      Reader& enter ( ) {
+        Reader& r = mine();
+        if (r.depth++ == 0) {
+          r.pinned.store(epoch.load(std::memory_order_relaxed), std::memory_order_release);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return r;
+      }
+
+      void leave (Reader& r) {
+        if (--r.depth == 0)
+          r.pinned.store(0, std::memory_order_release);
+      }
+
+      // Hand over 'object', already unpublished, to be destroyed by 'destroy' once
+      // no pinned reader can hold it.
+      void retire (void* object, void (*destroy)(void*)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lock(mutex);
+        limbo.push_back(Retired{object, destroy, epoch.load(std::memory_order_relaxed)});
+      }
+
+      // Advance the epoch as far as pinned readers allow, and destroy whatever has
+      // become unreachable.  Returns the number of objects destroyed.
+      std::size_t reclaim ( ) {
+        std::vector<Retired> expired;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (limbo.empty())
+            return 0;
+          try_advance() && try_advance();
+          std::uint64_t now  = epoch.load(std::memory_order_relaxed);
+          auto          keep = limbo.begin();
+          for (Retired& r : limbo) {
+            if (r.epoch + 2 <= now)
+              expired.push_back(r);
+            else
+              *keep++ = r;
+          }
+          limbo.erase(keep, limbo.end());
+        }
+        for (Retired& r : expired)
+          r.destroy(r.object);
+        return expired.size();
+      }
+
+    private:
+      struct Retired {
+        void*         object;
+        void          (*destroy)(void*);
+        std::uint64_t epoch;
+      };
+
+      // Releases the thread's Reader at thread exit.
+      struct Releaser {
+        Reader* reader;
+
+        ~Releaser ( ) {
+          reader->pinned.store(0, std::memory_order_release);
+          reader->depth = 0;
+          reader->in_use.store(false, std::memory_order_release);
+        }
+      };
+
+      Reader& mine ( ) {
+        static thread_local Releaser releaser {claim()};
+        return *releaser.reader;
+      }
+
+      // A free Reader, or a new one pushed onto the (never shrinking) list.
+      Reader* claim ( ) {
+        for (Reader* r = readers.load(std::memory_order_acquire); r; r = r->next) {
+          bool free = false;
+          if (!r->in_use.load(std::memory_order_relaxed) &&
+              r->in_use.compare_exchange_strong(free, true, std::memory_order_acquire))
+            return r;
+        }
+        Reader* r = new Reader;
+        r->in_use.store(true, std::memory_order_relaxed);
+        r->next = readers.load(std::memory_order_relaxed);
+        while (!readers.compare_exchange_weak(r->next, r, std::memory_order_release,
+                                              std::memory_order_relaxed))
+          ;
+        return r;
+      }
+
+      // Move to the next epoch if no reader is pinned in an earlier one.  Call with
+      // 'mutex' held.
+      bool try_advance ( ) {
+        std::uint64_t now = epoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (Reader* r = readers.load(std::memory_order_acquire); r; r = r->next) {
+          std::uint64_t pinned = r->pinned.load(std::memory_order_acquire);
+          if (pinned != 0 && pinned != now)
+            return false;
+        }
+        epoch.store(now + 1, std::memory_order_seq_cst);
+        return true;
+      }
+
+      std::atomic<std::uint64_t> epoch   {1};
+      std::atomic<Reader*>       readers {nullptr};
+      std::mutex                 mutex;            // guards 'limbo', serializes advances
+      std::vector<Retired>       limbo;
+    };
+
+    inline Epochs& epochs ( ) {
+      static Epochs e;
+      return e;
+    }
+
+
+    template <typename Dep, typename Tag> class Builder;
+
+  } // Internals
+
+
+  //
+  //  A Pin keeps every shared instance that the constructing thread retrieves while
+  //  it lives from being destroyed by a redeclaration, until the Pin ends.  Pins
+  //  nest, and cost nothing to get().
+  //
+  class Pin {
+  public:
+    Pin ( ) : reader(Internals::epochs().enter()) { }
+    ~Pin ( ) { Internals::epochs().leave(reader); }
+
+    Pin(Pin const&) = delete;
+    Pin& operator=(Pin const&) = delete;
+
+  private:
+    Internals::Epochs::Reader& reader;
+  };
+
+  // Destroy those instances replaced by redeclare() that no Pin can still reach.
+  // Returns how many were destroyed.  redeclare() also calls this.
+  inline std::size_t reclaim ( ) {
+    return Internals::epochs().reclaim();
+  }
+
+
+  //
+  //  A Scope owns the scoped dependencies resolved while it is current: from its
+  //  construction to its destruction, on the thread constructing it.  Each scoped
+  //  type+tag is constructed in the Scope's arena on first get(), and the whole
+  //  arena is released, after destroying its objects, when the Scope ends.
+  //
+  class Scope {
+  public:
+    // Bytes held within the Scope object itself before the arena turns to the heap.
+    static constexpr std::size_t inline_size = 1024;
+
+    Scope ( ) : previous(current()) {
+      current() = this;
+    }
+
+    ~Scope ( ) {
+      release();
+      current() = previous;
+    }
+
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+
+    // Retrieve a dependency as from Factory<Dep, Tag>::get(), with this Scope current.
+    template <typename Dep, typename Tag = DefaultTag>
+    Dep* get ( );
+
+    // Destroy this Scope's objects, most recently constructed first, and release
+    // its arena in one go.
+    void release ( ) {
+      for (Entry* e = entries; e; e = e->next)
+        e->destroy(e->where);
+      entries = nullptr;
+      arena.release();
+    }
+
+    // The Scope current on this thread, if any.
+    static Scope*& current ( ) {
+      static thread_local Scope* scope {nullptr};
+      return scope;
+    }
+
+  private:
+    template <typename, typename> friend class Internals::Builder;
+
+    // Each scoped object, listed newest first.
+    struct Entry {
+      void const* key;                  // its Builder
+      void*       dep;                  // as the declared interface type
+      void*       where;                // as constructed
+      void        (*destroy)(void*);
+      Entry*      next;
+    };
+
+    void* find (void const* key) const {
+      for (Entry* e = entries; e; e = e->next) {
+        if (e->key == key)
+          return e->dep;
+      }
+      return nullptr;
+    }
+
+    void* allocate (std::size_t size, std::size_t align) {
+      return arena.allocate(size, align);
+    }
+
+    void record (void const* key, void* dep, void* where, void (*destroy)(void*)) {
+      auto e = static_cast<Entry*>(arena.allocate(sizeof(Entry), alignof(Entry)));
+      *e = Entry{key, dep, where, destroy, entries};
+      entries = e;
+    }
+
+    alignas(std::max_align_t) char buffer[inline_size];
+    Internals::MonotonicArena      arena {buffer, inline_size};
+    Entry*                         entries {nullptr};
+    Scope*                         previous;
+  };
+
+
+  namespace Internals
+  {
+    //
+    //  A Builder object can build dependencies.
+    //
+    template <typename Dep, typename Tag>
+    class Builder final : public BuilderBase {
+    public:
+      using BuildFunc = InlineFunction<Dep*()>;
+      using ResetFunc = void (*)(Dep&);
+      using Handle    = std::unique_ptr<Dep, Disposer<Dep>>;
+      using Instance  = std::unique_ptr<Dep, InstanceDeleter<Dep>>;
+
+      // Instances each thread may hold back from the common pool.
+      static constexpr std::size_t thread_cache_size = 32;
+
+      Builder() = default;
+      Builder(Builder const&) = delete;
+      Builder& operator=(Builder const&) = delete;
+
+      ~Builder ( ) {
+        {
+          std::unique_lock<std::mutex> lock(async_mutex);
+          async_idle.wait(lock, [this]() { return in_flight == 0; });
+        }
+        drain_pool();
+      }
+
+      void declare (Declaration<Dep> const& decl) {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (builder)
+          fail<std::logic_error>("DepInject: declare: redeclaration for same type+tag");
+        if (!decl.builder)
+          fail<std::logic_error>("DepInject: declare: no allocation function provided");
+        builder    = decl.builder;
+        lifetime   = decl.lifetime;
+        reset_hook = decl.reset;
+        pool_limit = decl.max_idle;
+        placement  = decl.placement;
+        registry().enroll(this);
+      }
+
+      // Replace a shared declaration's builder.  If the common instance has been
+      // built, build its replacement now and publish it in its stead; the old one
+      // is retired, to be destroyed once no Pin can still reach it.  Refused while
+      // another shared instance whose builder built or waited for this one exists, or
+      // is being built, as that would keep the old instance beyond any Pin.
+      void redeclare (Declaration<Dep> const& decl) {
+        if (!decl.builder)
+          fail<std::logic_error>("DepInject: redeclare: no allocation function provided");
+        refuse_cycle();
+        refresh();
+        for (BuilderBase* user : registry().users(this)) {
+          if (BuildScope::contains(user) || user->built_at() != 0)
+            fail<std::logic_error>("DepInject: redeclare: instance held by another shared instance");
+        }
+        Dep* retired = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!builder)
+            fail<std::logic_error>("DepInject: redeclare: object type+tag not declared");
+          if (lifetime != Lifetime::shared)
+            fail<std::logic_error>("DepInject: redeclare: only shared declarations may be redeclared");
+          if (placement)
+            fail<std::logic_error>("DepInject: redeclare: in-place declarations may not be redeclared");
+          BuildFunc previous = builder;
+          builder = decl.builder;
+          if (common_instance) {
+            std::uint64_t began       = registry().next_build_stamp();
+            Dep*          replacement = nullptr;
+            DEPINJECT_TRY {
+              replacement = invoke();
+            }
+            DEPINJECT_CATCH_ALL {
+              builder = previous;
+              DEPINJECT_RETHROW;
+            }
+            if (!replacement) {
+              builder = previous;
+              fail<std::runtime_error>("DepInject: redeclare: object allocation failed");
+            }
+            retired = common_instance.release();
+            common_instance = Instance(replacement);
+            build_began     = began;
+            build_stamp     = registry().next_build_stamp();
+            published.store(replacement, std::memory_order_release);
+          }
+        }
+        if (retired) {
+          epochs().retire(retired, [](void* dep) { delete static_cast<Dep*>(dep); });
+          epochs().reclaim();
+        }
+      }
+
+      Dep* get (bool uniq) {
+#ifdef DEPINJECT_METRICS
+        metrics.count_get(uniq);
+#endif
+        if (Dep* dep = get_fast(uniq))
+          return dep;
+        return get_slow(uniq);
+      }
+
+      Result<Dep> try_get (bool uniq) noexcept {
+#ifdef DEPINJECT_METRICS
+        metrics.count_get(uniq);
+#endif
+        if (Dep* dep = get_fast(uniq))
+          return dep;
+        return try_get_slow(uniq);
+      }
+
+      // The common instance, as a future.  Unless it is built or already being built,
+      // queue a build on the background pool; get() meanwhile waits for that build if
+      // it has begun, or builds the instance itself if not.
+      std::shared_future<Dep*> get_async ( ) {
+        refresh();
+        if (Dep* dep = published.load(std::memory_order_acquire))
+          return ready(dep);
+        {
+          // A background build holds 'mutex' throughout, so look for one first.
+          std::lock_guard<std::mutex> lock(async_mutex);
+          if (building())
+            return async_result;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Error err = check_declaration(false);
+        if (err != Error::none)
+          fail(err);
+        if (lifetime != Lifetime::shared)
+          fail<std::logic_error>("DepInject: get_async: only shared declarations may be built in the background");
+        if (closed)
+          fail(Error::after_shutdown);
+        if (common_instance)
+          return ready(common_instance.get());
+        std::lock_guard<std::mutex> async_lock(async_mutex);
+        if (building())
+          return async_result;
+
+        auto promise = std::make_shared<std::promise<Dep*>>();
+        async_result = promise->get_future().share();
+        std::uintptr_t declared = serial.load(std::memory_order_relaxed);
+        background().submit([this, promise, declared]() {
+          build_in_background(*promise, declared);
+        });
+        ++in_flight;
+        return async_result;
+      }
+
+      // Whether a background build is queued or running.  Call with 'async_mutex' held.
+      bool building ( ) const {
+        return async_result.valid() &&
+               async_result.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+      }
+
+      // A future already holding 'dep'.
+      static std::shared_future<Dep*> ready (Dep* dep) {
+        std::promise<Dep*> promise;
+        promise.set_value(dep);
+        return promise.get_future().share();
+      }
+
+      Handle get_handle ( ) {
+#ifdef DEPINJECT_METRICS
+        metrics.count_get(true);
+#endif
+        Dep* dep = get_slow(true);
+        if (lifetime == Lifetime::pooled)
+          return Handle(dep, Disposer<Dep>(&recycle, this,
+                                           serial.load(std::memory_order_relaxed)));
+        return Handle(dep);
+      }
+
+      // Build 'n' unique instances.  If the declaration names its concrete class,
+      // they are constructed side by side in one Batch; otherwise each is built and
+      // handed out as by get_handle().
+      std::vector<Handle> get_handles (std::size_t n) {
+        refresh();
+        std::vector<Handle> handles;
+        handles.reserve(n);
+        if (lifetime != Lifetime::unique || !placement || n == 0) {
+          while (handles.size() < n)
+            handles.push_back(get_handle());
+          return handles;
+        }
+#ifdef DEPINJECT_METRICS
+        metrics.count_get(true, n);
+#endif
+        Error err = check_declaration(true);
+        if (err != Error::none)
+          fail(err);
+        Batch<Dep>* batch = Batch<Dep>::create(placement, n);
+        DEPINJECT_TRY {
+          for (std::size_t i = 0; i < n; ++i) {
+            void* where = batch->slot(i);
+            Dep*  dep   = run_builder([this, where]() { return placement.construct(where); });
+            handles.push_back(Handle(dep, Disposer<Dep>(&Batch<Dep>::release, batch, i)));
+          }
+        }
+        DEPINJECT_CATCH_ALL {
+          std::size_t built = handles.size();
+          handles.clear();                    // destroys what was built
+          batch->drop(n - built);
+          DEPINJECT_RETHROW;
+        }
+        return handles;
+      }
+
+      bool prewarm (std::chrono::nanoseconds& elapsed) override {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!builder || closed)
+          return false;
+        bool shared = lifetime == Lifetime::shared && !common_instance;
+        if (!shared && (lifetime != Lifetime::per_cpu || cpu_instances))
+          return false;
+        auto start = std::chrono::steady_clock::now();
+        if (!(shared ? build_common() : build_per_cpu()))
+          fail<std::runtime_error>("DepInject: prewarm: object allocation failed");
+        elapsed = std::chrono::steady_clock::now() - start;
+        return true;
+      }
+
+      std::uint64_t built_at ( ) override {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        return common_instance || cpu_instances ? build_stamp : 0;
+      }
+
+      std::uint64_t began_at ( ) override {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        return common_instance || cpu_instances ? build_began : 0;
+      }
+
+      // Under 'mutex', so that no build in progress publishes after it.  Bumping the
+      // serial number disowns per-thread instances too.
+      void unpublish ( ) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        published.store(nullptr, std::memory_order_release);
+        cpu_published.store(nullptr, std::memory_order_release);
+        serial.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      bool shut_down (bool fast) override {
+        refresh();
+        Instance                        doomed;
+        std::unique_ptr<CpuShards<Dep>> doomed_shards;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          closed = true;
+          published.store(nullptr, std::memory_order_relaxed);
+          cpu_published.store(nullptr, std::memory_order_relaxed);
+          inplace_where = nullptr;            // occupied until destroyed, if ever
+          if (fast && abandonable) {
+            static_cast<void>(common_instance.release());
+            static_cast<void>(cpu_instances.release());
+          }
+          else {
+            doomed        = std::move(common_instance);
+            doomed_shards = std::move(cpu_instances);
+          }
+        }
+        drain_pool();
+        bool destroyed = doomed != nullptr || doomed_shards != nullptr;
+        doomed.reset();                       // outside the lock
+        doomed_shards.reset();
+        return destroyed;
+      }
+
+      // Call 'f' with every CPU's instance of a per-CPU declaration, if built.
+      template <typename Func>
+      void visit_per_cpu (Func& f) {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!builder)
+          fail(Error::not_declared);
+        if (lifetime != Lifetime::per_cpu)
+          fail<std::logic_error>("DepInject: visit_per_cpu: declaration is not per-CPU");
+        if (cpu_instances)
+          cpu_instances->visit(f);
+      }
+
+      // Let a fast-exit shutdown() leave the common instance undestroyed.
+      void mark_abandonable ( ) {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        abandonable = true;
+      }
+
+      std::string const& dependency_name ( ) const override {
+        return type_name<Dep>();
+      }
+
+      std::string const& tag_name ( ) const override {
+        return type_name<Tag>();
+      }
+
+      void testing_reset ( ) {
+        // This function for testing DepInject itself.  Not for general use.
+        // It reinitializes the Builder singleton, clearing its state.  Pooled
+        // instances still cached by other threads, or still in use, are deleted
+        // rather than recycled once they notice the serial number has changed.
+        std::lock_guard<std::mutex> lock(mutex);
+        reset_locked();
+        registry().forget_dependencies(this);
+        generation.store(Generation<>::current.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+      }
+
+    private:
+      //
+      //  A per-thread stack of idle pooled instances, refilled from and spilled to
+      //  the common pool in batches so that the pool mutex is rarely taken.
+      //
+      struct ThreadCache {
+        Builder*       owner  {nullptr};
+        std::uintptr_t serial {0};
+        std::size_t    count  {0};
+        Dep*           slots[thread_cache_size];
+
+        ~ThreadCache ( ) {
+          if (owner)
+            owner->spill(*this, count);
+        }
+
+        void discard ( ) {
+          while (count)
+            delete slots[--count];
+        }
+      };
+
+      static ThreadCache& thread_cache ( ) {
+        static thread_local ThreadCache cache;
+        return cache;
+      }
+
+      //
+      //  A thread's own instance of a thread-local declaration.  Trivially
+      //  destructible, so the fast path needs no thread_local guard; the reaper,
+      //  created along with the first instance, deletes it at thread exit.
+      //
+      struct ThreadInstance {
+        Dep*           dep;
+        std::uintptr_t serial;
+      };
+
+      struct ThreadReaper {
+        ~ThreadReaper ( ) {
+          ThreadInstance& mine = thread_instance();
+          delete mine.dep;
+          mine.dep = nullptr;
+        }
+      };
+
+      static ThreadInstance& thread_instance ( ) {
+        static thread_local ThreadInstance mine {nullptr, 0};
+        return mine;
+      }
+
+      Error check_declaration (bool uniq) const noexcept {
+        if (!builder)
+          return Error::not_declared;
+        if (uniq != is_unique(lifetime))
+          return uniq ? Error::unique_mismatch : Error::shared_mismatch;
+        return Error::none;
+      }
+
+      // Clear all state but the declared dependencies, which the Registry ignores
+      // once they are of an earlier generation.  Call with 'mutex' held.
+      void reset_locked ( ) {
+        builder    = nullptr;
+        published.store(nullptr, std::memory_order_relaxed);
+        common_instance.reset();
+        cpu_published.store(nullptr, std::memory_order_relaxed);
+        cpu_instances.reset();
+        lifetime   = Lifetime::shared;
+        reset_hook = nullptr;
+        pool_limit = 0;
+        placement  = Placement<Dep>();
+        abandonable = false;
+        closed      = false;
+        {
+          std::lock_guard<std::mutex> async_lock(async_mutex);
+          async_result = std::shared_future<Dep*>();
+        }
+        build_began = 0;
+        build_stamp = 0;
+        serial.fetch_add(1, std::memory_order_relaxed);
+        drain_pool();
+      }
+
+      // Reset, if last used in an earlier generation (see testing_reset_all()).
+      void refresh ( ) {
+        std::uint64_t now = Generation<>::current.load(std::memory_order_relaxed);
+        if (generation.load(std::memory_order_relaxed) == now)
+          return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (generation.load(std::memory_order_relaxed) != now) {
+          reset_locked();
+          generation.store(now, std::memory_order_relaxed);
+        }
+      }
+
+      // Build the common instance on a background thread, for get_async(), unless the
+      // declaration has since been reset.  Without exceptions, a failed build yields
+      // nullptr.
+      void build_in_background (std::promise<Dep*>& promise, std::uintptr_t declared) {
+        refresh();
+        std::unique_lock<std::mutex> lock(mutex);
+        Dep*  dep = nullptr;
+        Error err = Error::none;
+#if DEPINJECT_EXCEPTIONS
+        std::exception_ptr thrown;
+#endif
+        if (serial.load(std::memory_order_relaxed) != declared || !builder)
+          err = Error::not_declared;
+        else if (closed)
+          err = Error::after_shutdown;
+        else {
+#if DEPINJECT_EXCEPTIONS
+          try {
+            dep = build_common();
+          }
+          catch (...) {
+            thrown = std::current_exception();
+          }
+#else
+          dep = build_common();
+#endif
+          if (!dep)
+            err = Error::allocation_failed;
+        }
+        lock.unlock();
+        {
+          std::lock_guard<std::mutex> async_lock(async_mutex);
+          --in_flight;
+          async_idle.notify_all();
+        }
+
+#if DEPINJECT_EXCEPTIONS
+        if (thrown)
+          promise.set_exception(thrown);
+        else if (err != Error::none) {
+          try {
+            fail(err);
+          }
+          catch (...) {
+            promise.set_exception(std::current_exception());
+          }
+        }
+        else
+          promise.set_value(dep);
+#else
+        promise.set_value(err == Error::none ? dep : nullptr);
+#endif
+      }
+
+      // Fast paths: a published common instance, the current CPU's published instance,
+      // or this thread's own instance of the current declaration, needs no further
+      // checks, as testing_reset_all() unpublishes them all.  Only a shared get() that
+      // misses the first looks at the lifetime, to try just the one path it declares.
+      // Otherwise returns nullptr.
+      Dep* get_fast (bool uniq) noexcept {
+        if (!uniq) {
+          if (Dep* dep = published.load(std::memory_order_acquire))
+            return dep;
+          if (lifetime == Lifetime::per_thread) {
+            ThreadInstance& mine = thread_instance();
+            if (mine.dep && mine.serial == serial.load(std::memory_order_relaxed))
+              return mine.dep;
+          }
+          else if (lifetime == Lifetime::per_cpu) {
+            if (CpuShards<Dep> const* shards = cpu_published.load(std::memory_order_acquire))
+              return shards->local();
+          }
+        }
+        return nullptr;
+      }
+
+      Dep* get_slow (bool uniq) {
+        Dep*  dep = nullptr;
+        Error err = build(uniq, dep);
+        if (err != Error::none)
+          fail(err);
+        return dep;
+      }
+
+      // As get_slow(), reporting an exception thrown while building as build_threw.
+      Result<Dep> try_get_slow (bool uniq) noexcept {
+        Dep*  dep = nullptr;
+        Error err = Error::build_threw;
+        DEPINJECT_TRY {
+          err = build(uniq, dep);
+        }
+        DEPINJECT_CATCH_ALL {
+          err = Error::build_threw;
+        }
+        if (err != Error::none)
+          return err;
+        return dep;
+      }
+
+      // Find or build an instance for get() or get_unique().  Builders' exceptions
+      // propagate; DepInject's own failures are returned.
+      Error build (bool uniq, Dep*& dep) {
+        // Status checks.
+        refresh();
+        Error err = check_declaration(uniq);
+        if (err != Error::none)
+          return err;
+        if (BuildScope::contains(this))
+          return Error::dependency_cycle;   // before we would wait on our own lock
+
+        // Call the user-supplied builder function.  The common instance is built
+        // under the lock so that racing first callers construct it only once; the
+        // winner publishes it for the lock-free fast path.
+        if (lifetime == Lifetime::pooled)
+          dep = acquire();
+        else if (lifetime == Lifetime::unique)
+          dep = invoke();
+        else if (lifetime == Lifetime::per_thread)
+          dep = build_thread_instance();
+        else if (lifetime == Lifetime::scoped) {
+          if (!Scope::current())
+            return Error::outside_scope;
+          dep = build_scoped();
+        }
+        else {
+          BuildScope::note_use(this);
+          std::lock_guard<std::mutex> lock(mutex);
+          if (closed)
+            return Error::after_shutdown;
+          dep = lifetime == Lifetime::per_cpu ? build_per_cpu() : build_common();
+        }
+
+        // Note that we have no 'dep' to clean up if there's a problem.
+        // If the builder() threw an exception (say, memory allocation failure),
+        // then we won't be getting this far anyway.
+        return dep ? Error::none : Error::allocation_failed;
+      }
+
+      void refuse_cycle ( ) const {
+        if (BuildScope::contains(this))
+          fail(Error::dependency_cycle);
+      }
+
+      // Run 'make', which calls upon the user's declaration to build an instance,
+      // noting that it is running (and, with DEPINJECT_METRICS, timing it).  The
+      // builds of instances that shutdown() destroys record what they use.
+      template <typename Make>
+      Dep* run_builder (Make make) {
+        refuse_cycle();
+        BuildScope scope(this, lifetime == Lifetime::shared || lifetime == Lifetime::per_cpu);
+#ifdef DEPINJECT_METRICS
+        auto start = std::chrono::steady_clock::now();
+        Dep* dep   = nullptr;
+        DEPINJECT_TRY {
+          dep = make();
+        }
+        DEPINJECT_CATCH_ALL {
+          metrics.count_build(std::chrono::steady_clock::now() - start, true);
+          DEPINJECT_RETHROW;
+        }
+        metrics.count_build(std::chrono::steady_clock::now() - start, dep == nullptr);
+#else
+        Dep* dep = make();
+#endif
+        scope.returned(dep);
+        return dep;
+      }
+
+      // Call the user-supplied builder function.
+      Dep* invoke ( ) {
+        return run_builder([this]() { return builder(); });
+      }
+
+      // Build and publish the common instance, unless already built.  Call with
+      // 'mutex' held.
+      Dep* build_common ( ) {
+        if (!common_instance) {
+          std::uint64_t began = registry().next_build_stamp();
+          common_instance = placement ? build_inplace() : Instance(invoke());
+          build_began     = began;
+          build_stamp     = registry().next_build_stamp();
+          published.store(common_instance.get(), std::memory_order_release);
+        }
+        return common_instance.get();
+      }
+
+      // Construct an in-place declaration's common instance in the InplaceRegion, in
+      // the space of this type+tag's last one if it fits.  Call with 'mutex' held.
+      Instance build_inplace ( ) {
+        if (!inplace_where || inplace_size < placement.size ||
+            reinterpret_cast<std::uintptr_t>(inplace_where) % placement.align != 0) {
+          inplace_where = InplaceRegion<>::allocate(placement.size, placement.align);
+          inplace_size  = placement.size;
+        }
+        void* where = inplace_where;
+        Dep*  dep   = run_builder([this, where]() { return placement.construct(where); });
+        return Instance(dep, InstanceDeleter<Dep>{placement.destroy, where});
+      }
+
+      // Build and publish every CPU's instance, unless already built, returning the
+      // current CPU's.  Call with 'mutex' held.
+      Dep* build_per_cpu ( ) {
+        if (!cpu_instances) {
+          std::uint64_t                   began = registry().next_build_stamp();
+          std::unique_ptr<CpuShards<Dep>> shards(
+            new CpuShards<Dep>(placement, CpuShards<Dep>::cpus()));
+          if (!shards->build([this](void* where) {
+                return run_builder([this, where]() { return placement.construct(where); });
+              }))
+            return nullptr;
+          cpu_instances = std::move(shards);
+          build_began   = began;
+          build_stamp   = registry().next_build_stamp();
+          cpu_published.store(cpu_instances.get(), std::memory_order_release);
+        }
+        return cpu_instances->local();
+      }
+
+      // Build the calling thread's instance, replacing any left from an earlier
+      // declaration.
+      Dep* build_thread_instance ( ) {
+        static thread_local ThreadReaper reaper;
+        static_cast<void>(reaper);
+
+        ThreadInstance& mine = thread_instance();
+        std::uintptr_t  now  = serial.load(std::memory_order_relaxed);
+        if (!mine.dep || mine.serial != now) {
+          delete mine.dep;
+          mine.dep    = nullptr;
+          mine.dep    = invoke();
+          mine.serial = now;
+        }
+        return mine.dep;
+      }
+
+      // Find or construct the current Scope's instance.  There must be one.
+      Dep* build_scoped ( ) {
+        Scope* scope = Scope::current();
+        if (void* found = scope->find(this))
+          return static_cast<Dep*>(found);
+        void* where = scope->allocate(placement.size, placement.align);
+        Dep*  dep   = run_builder([this, where]() { return placement.construct(where); });
+        scope->record(this, dep, where, placement.destroy);
+        return dep;
+      }
+
+      // Bind the calling thread's cache to the current declaration, discarding
+      // anything it holds from an earlier one.
+      ThreadCache& current_cache ( ) {
+        ThreadCache&   cache = thread_cache();
+        std::uintptr_t now   = serial.load(std::memory_order_relaxed);
+        if (cache.owner != this || cache.serial != now) {
+          cache.discard();
+          cache.owner  = this;
+          cache.serial = now;
+        }
+        return cache;
+      }
+
+      Dep* acquire ( ) {
+        ThreadCache& cache = current_cache();
+        if (cache.count == 0) {
+          // Refill half the cache from the common pool.
+          std::lock_guard<std::mutex> lock(pool_mutex);
+          while (!pool.empty() && cache.count < thread_cache_size / 2) {
+            cache.slots[cache.count++] = pool.back();
+            pool.pop_back();
+          }
+        }
+        if (cache.count)
+          return cache.slots[--cache.count];
+        return invoke();
+      }
+
+      static void recycle (Dep* dep, void* context, std::uintptr_t cookie) {
+        auto self = static_cast<Builder*>(context);
+        if (cookie != self->serial.load(std::memory_order_relaxed) ||
+            self->generation.load(std::memory_order_relaxed) !=
+              Generation<>::current.load(std::memory_order_relaxed)) {
+          delete dep;           // released after a testing_reset() or testing_reset_all()
+          return;
+        }
+        if (self->reset_hook)
+          self->reset_hook(*dep);
+        ThreadCache& cache = self->current_cache();
+        if (cache.count == thread_cache_size)
+          self->spill(cache, thread_cache_size / 2);
+        cache.slots[cache.count++] = dep;
+      }
+
+      // Move 'n' instances from a thread's cache to the common pool, deleting any
+      // beyond the declared limit on idle instances.
+      void spill (ThreadCache& cache, std::size_t n) {
+        if (cache.serial != serial.load(std::memory_order_relaxed)) {
+          cache.discard();
+          return;
+        }
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (; n && cache.count; --n) {
+          Dep* dep = cache.slots[--cache.count];
+          if (pool.size() < pool_limit)
+            pool.push_back(dep);
+          else
+            delete dep;
+        }
+      }
+
+      void drain_pool ( ) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (Dep* dep : pool)
+          delete dep;
+        pool.clear();
+      }
+
+      BuildFunc                   builder;
+      Instance                    common_instance;
+      std::atomic<Dep*>           published  {nullptr};
+      std::mutex                  mutex;
+      Lifetime                    lifetime   {Lifetime::shared};
+      std::uint64_t               build_began {0};
+      std::uint64_t               build_stamp {0};
+      bool                        abandonable {false};
+      bool                        closed      {false};   // by shutdown()
+
+      Placement<Dep>              placement;
+
+      // The InplaceRegion space of the last in-place instance, kept across resets for
+      // the next (see build_inplace()), but given up by shut_down().
+      void*                       inplace_where {nullptr};
+      std::size_t                 inplace_size  {0};
+
+      // Per-CPU instances (see build_per_cpu()).
+      std::unique_ptr<CpuShards<Dep>> cpu_instances;
+      std::atomic<CpuShards<Dep>*>    cpu_published {nullptr};
+
+      ResetFunc                   reset_hook {nullptr};
+      std::size_t                 pool_limit {0};
+      std::atomic<std::uintptr_t> serial     {0};
+      std::atomic<std::uint64_t>  generation {Generation<>::current.load(std::memory_order_relaxed)};
+      std::mutex                  pool_mutex;
+      std::vector<Dep*>           pool;
+
+      // Background builds (see get_async()).  Lock 'async_mutex' after 'mutex', if both.
+      std::mutex                  async_mutex;
+      std::shared_future<Dep*>    async_result;
+      std::size_t                 in_flight  {0};     // queued or running
+      std::condition_variable     async_idle;
+    };
+
+
+    //
+    //  The instances of a keyed declaration, one per key.  Keys are spread over
+    //  'shard_count' shards, each with its own mutex and fixed array of bucket chains.
+    //  Chains only grow, by prepending a node under the shard's mutex, so a lookup of
+    //  an existing key walks its chain with acquire loads alone.  close() destroys the
+    //  instances but leaves their nodes, which are freed only when the whole map is
+    //  destroyed.
+    //
+    template <typename Key, typename Dep>
+    class KeyedMap {
+    public:
+      static constexpr std::size_t shard_count = 64;
+
+      // Sized for about 'expected' keys; more only lengthen the chains.
+      explicit KeyedMap (std::size_t expected) {
+        while (buckets_per_shard * shard_count < expected)
+          buckets_per_shard *= 2;
+        for (Shard& shard : shards) {
+          shard.buckets.reset(new std::atomic<Node*>[buckets_per_shard]);
+          for (std::size_t b = 0; b < buckets_per_shard; ++b)
+            shard.buckets[b].store(nullptr, std::memory_order_relaxed);
+        }
+      }
+
+      ~KeyedMap ( ) {
+        for (Shard& shard : shards) {
+          for (std::size_t b = 0; b < buckets_per_shard; ++b) {
+            Node* next = nullptr;
+            for (Node* n = shard.buckets[b].load(std::memory_order_relaxed); n; n = next) {
+              next = n->next;
+              delete n->dep.load(std::memory_order_relaxed);
+              delete n;
+            }
+          }
+        }
+      }
+
+      KeyedMap(KeyedMap const&) = delete;
+      KeyedMap& operator=(KeyedMap const&) = delete;
+
+      // The instance for 'key', or nullptr if it is not built or has been closed.
+      Dep* find (Key const& key, std::size_t hash) const noexcept {
+        for (Node const* n = head(hash).load(std::memory_order_acquire); n; n = n->next) {
+          if (n->hash == hash && n->key == key)
+            return n->dep.load(std::memory_order_relaxed);
+        }
+        return nullptr;
+      }
+
+      // The instance for 'key', built by 'make' under the shard's mutex if there is
+      // none yet, unless 'limit' (if nonzero) keys are already held or the map has
+      // been closed.
+      template <typename Make>
+      Error find_or_build (Key const& key, std::size_t hash, std::size_t limit,
+                           Make make, Dep*& dep) {
+        Shard&                      sh = shard(hash);
+        std::lock_guard<std::mutex> lock(sh.mutex);
+        if (sh.closed)
+          return Error::after_shutdown;
+        dep = find(key, hash);
+        if (dep)
+          return Error::none;
+        if (limit && size.fetch_add(1, std::memory_order_relaxed) >= limit) {
+          size.fetch_sub(1, std::memory_order_relaxed);
+          return Error::key_limit;
+        }
+        if (!limit)
+          size.fetch_add(1, std::memory_order_relaxed);
+        std::unique_ptr<Dep> built;
+        DEPINJECT_TRY {
+          built.reset(make());
+        }
+        DEPINJECT_CATCH_ALL {
+          size.fetch_sub(1, std::memory_order_relaxed);
+          DEPINJECT_RETHROW;
+        }
+        if (!built) {
+          size.fetch_sub(1, std::memory_order_relaxed);
+          return Error::allocation_failed;
+        }
+        std::atomic<Node*>& first = head(hash);
+        Node* node = new Node(key, hash, built.get(), first.load(std::memory_order_relaxed));
+        dep = built.release();
+        first.store(node, std::memory_order_release);
+        return Error::none;
+      }
+
+      // Destroy every instance, and build no more; lookups find none.  The nodes stay,
+      // so that a lookup racing this one walks no freed memory.  Returns how many
+      // instances were destroyed.
+      std::size_t close ( ) {
+        std::size_t destroyed = 0;
+        for (Shard& sh : shards) {
+          std::lock_guard<std::mutex> lock(sh.mutex);
+          sh.closed = true;
+          for (std::size_t b = 0; b < buckets_per_shard; ++b) {
+            for (Node* n = sh.buckets[b].load(std::memory_order_relaxed); n; n = n->next) {
+              if (Dep* dep = n->dep.exchange(nullptr, std::memory_order_relaxed)) {
+                delete dep;
+                ++destroyed;
+              }
+            }
+          }
+        }
+        return destroyed;
+      }
+
+      std::size_t keys ( ) const {
+        return size.load(std::memory_order_relaxed);
+      }
+
+    private:
+      struct Node {
+        Node (Key const& k, std::size_t h, Dep* d, Node* n) : key(k), hash(h), dep(d), next(n) { }
+
+        Key               key;
+        std::size_t       hash;
+        std::atomic<Dep*> dep;                // null once closed
+        Node*             next;               // fixed once published
+      };
+
+      // Padded, so that neighbouring shards' mutexes don't share a cache line.
+      struct Shard {
+        std::mutex                            mutex;
+        std::unique_ptr<std::atomic<Node*>[]> buckets;
+        bool                                  closed {false};   // guarded by 'mutex'
+        char                                  padding[64];
+      };
+
+      Shard& shard (std::size_t hash) {
+        return shards[hash % shard_count];
+      }
+
+      std::atomic<Node*>& head (std::size_t hash) const {
+        return shards[hash % shard_count].buckets[(hash / shard_count) % buckets_per_shard];
+      }
+
+      std::array<Shard, shard_count> shards;
+      std::size_t                    buckets_per_shard {1};
+      std::atomic<std::size_t>       size {0};
+    };
+
+
+    //
+    //  A KeyedBuilder builds one shared instance per key of a keyed declaration,
+    //  on that key's first get().  The declaration and its map are published as one
+    //  State.  A State unpublished by shutdown() (which closes its map) or by
+    //  testing_reset_all() is parked rather than freed, so that a get() still walking
+    //  its map needs no Pin; parked States are freed on the reset's next refresh(), or
+    //  with the Builder.  Only declaring and unpublishing take the Builder's mutex.
+    //
+    template <typename Dep, typename Tag, typename Key>
+    class KeyedBuilder final : public BuilderBase {
+    public:
+      using BuildFunc = InlineFunction<Dep*(Key const&)>;
+      using Map       = KeyedMap<Key, Dep>;
+
+      // Keys a declaration without a limit is sized for.
+      static constexpr std::size_t default_keys = 16384;
+
+      KeyedBuilder() = default;
+      KeyedBuilder(KeyedBuilder const&) = delete;
+      KeyedBuilder& operator=(KeyedBuilder const&) = delete;
+
+      ~KeyedBuilder ( ) {
+        delete state.load(std::memory_order_relaxed);
+        for (State* st : parked)
+          delete st;
+      }
+
+      void declare (BuildFunc const& bldr, std::size_t max_keys) {
+        refresh();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state.load(std::memory_order_relaxed))
+          fail<std::logic_error>("DepInject: declare: redeclaration for same type+tag");
+        if (!bldr)
+          fail<std::logic_error>("DepInject: declare: no allocation function provided");
+        state.store(new State(bldr, max_keys), std::memory_order_release);
+        registry().enroll(this);
+      }
+
+      Dep* get (Key const& key) {
+#ifdef DEPINJECT_METRICS
+        metrics.count_get(false);
+#endif
+        std::size_t hash = std::hash<Key>()(key);
+        if (State const* st = state.load(std::memory_order_acquire)) {
+          if (Dep* dep = st->map.find(key, hash))
+            return dep;
+        }
+        return get_slow(key, hash);
+      }
+
+      std::size_t keys ( ) {
+        refresh();
+        State const* st = state.load(std::memory_order_acquire);
+        return st ? st->map.keys() : 0;
+      }
+
+      bool prewarm (std::chrono::nanoseconds&) override {
+        return false;                   // no keys are known in advance
+      }
+
+      std::uint64_t built_at ( ) override {
+        refresh();
+        return build_stamp.load(std::memory_order_relaxed);
+      }
+
+      std::uint64_t began_at ( ) override {
+        refresh();
+        return first_began.load(std::memory_order_relaxed);
+      }
+
+      void unpublish ( ) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        park(state.exchange(nullptr, std::memory_order_acq_rel));
+      }
+
+      bool shut_down (bool) override {
+        refresh();
+        State* doomed = nullptr;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          closed.store(true, std::memory_order_release);
+          doomed = state.exchange(nullptr, std::memory_order_acq_rel);
+          park(doomed);
+        }
+        return doomed && doomed->map.close() != 0;      // outside the lock
+      }
+
+      std::string const& dependency_name ( ) const override {
+        return type_name<Dep>();
+      }
+
+      std::string const& tag_name ( ) const override {
+        return type_name<Tag>();
+      }
+
+    private:
+      struct State {
+        State (BuildFunc const& bldr, std::size_t max_keys)
+          : builder(bldr), limit(max_keys), map(max_keys ? max_keys : default_keys) { }
+
+        BuildFunc   builder;
+        std::size_t limit;                    // of keys, if nonzero
+        Map         map;
+      };
+
+      // Build 'key''s instance, unless another thread has.
+      Dep* get_slow (Key const& key, std::size_t hash) {
+        refresh();
+        if (closed.load(std::memory_order_acquire))
+          fail(Error::after_shutdown);
+        State* st = state.load(std::memory_order_acquire);
+        if (!st)
+          fail(Error::not_declared);
+        if (BuildScope::contains(this))
+          fail(Error::dependency_cycle);
+        BuildScope::note_use(this);
+
+        Dep*  dep = nullptr;
+        Error err = st->map.find_or_build(key, hash, st->limit, [this, st, &key]() {
+          std::uint64_t began = registry().next_build_stamp();
+          BuildScope    scope(this, true);
+#ifdef DEPINJECT_METRICS
+          auto start = std::chrono::steady_clock::now();
+          Dep* built = nullptr;
+          DEPINJECT_TRY {
+            built = st->builder(key);
+          }
+          DEPINJECT_CATCH_ALL {
+            metrics.count_build(std::chrono::steady_clock::now() - start, true);
+            DEPINJECT_RETHROW;
+          }
+          metrics.count_build(std::chrono::steady_clock::now() - start, built == nullptr);
+#else
+          Dep* built = st->builder(key);
+#endif
+          scope.returned(built);
+          if (built) {
+            std::uint64_t first = 0;
+            while (!first_began.compare_exchange_weak(first, first && first < began ? first : began,
+                                                      std::memory_order_relaxed)) { }
+            build_stamp.store(registry().next_build_stamp(), std::memory_order_relaxed);
+          }
+          return built;
+        }, dep);
+        if (err != Error::none)
+          fail(err);
+        return dep;
+      }
+
+      // Keep an unpublished State until a reset, as a get() may still be reading it.
+      // Call with 'mutex' held.
+      void park (State* st) {
+        if (st)
+          parked.push_back(st);
+      }
+
+      // Reset, if last used in an earlier generation (see testing_reset_all()).  As
+      // resets are for tests, which make no get() across one, the parked States are
+      // freed here.
+      void refresh ( ) {
+        std::uint64_t now = Generation<>::current.load(std::memory_order_relaxed);
+        if (generation.load(std::memory_order_relaxed) == now)
+          return;
+        std::vector<State*> doomed;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (generation.load(std::memory_order_relaxed) != now) {
+            park(state.exchange(nullptr, std::memory_order_acq_rel));
+            doomed.swap(parked);
+            closed.store(false, std::memory_order_relaxed);
+            first_began.store(0, std::memory_order_relaxed);
+            build_stamp.store(0, std::memory_order_relaxed);
+            generation.store(now, std::memory_order_relaxed);
+          }
+        }
+        for (State* st : doomed)                         // outside the lock
+          delete st;
+      }
+
+      std::atomic<State*>         state  {nullptr};
+      std::atomic<bool>           closed {false};        // by shutdown()
+      std::mutex                  mutex;                 // serializes declare and unpublish
+      std::vector<State*>         parked;                // guarded by 'mutex'
+      std::atomic<std::uint64_t>  first_began {0};       // of the earliest key built
+      std::atomic<std::uint64_t>  build_stamp {0};       // of the latest key built
+      std::atomic<std::uint64_t>  generation {Generation<>::current.load(std::memory_order_relaxed)};
+    };
+
+  } // Internals
+
+
+  //
+  //  Builders work in (singleton) Factories.
+  //  DepInject users only call Factory<Dep> methods.
+  //
+  struct DefaultTag { };
+
+
+  //
+  //  A compile-time binding of a type+tag to a concrete class.  Specialized only by
+  //  DEPINJECT_BIND(); unbound type+tags are resolved at run time.
+  //
+  template <typename Dep, typename Tag = DefaultTag>
+  struct Binding {
+    static constexpr bool bound = false;
+  };
+
+  namespace Internals
+  {
+    template <typename Dep, typename Tag>
+    struct StaticInstance {
+      static typename Binding<Dep, Tag>::type object;
+    };
+
+    template <typename Dep, typename Tag>
+    typename Binding<Dep, Tag>::type StaticInstance<Dep, Tag>::object;
+
+  } // Internals
+
+
+  // The statically bound object for a type+tag, as its concrete type.
+  template <typename Dep, typename Tag = DefaultTag>
+  inline typename Binding<Dep, Tag>::type& bound ( ) {
+    return Internals::StaticInstance<Dep, Tag>::object;
+  }
+
+
+  template <typename Dep, typename Tag>
+  class Factory {
+    using Builder     = Internals::Builder<Dep, Tag>;
+    using Lifetime    = Internals::Lifetime;
+    using Declaration = Internals::Declaration<Dep>;
+    using IsBound   = std::integral_constant<bool, Binding<Dep, Tag>::bound>;
+
+  public:
+    Factory() = default;
+    Factory(Factory const&) = delete;
+    Factory& operator=(Factory const&) = delete;
+
+    // A builder is any callable returning Dep*; it is stored inline (see "Notes on
+    // builders").
+    template <typename Func>
+    static void declare (Func&& bldr) {
+      declare_as(std::forward<Func>(bldr), Lifetime::shared);
+    }
+
+    // Replace a shared declaration's builder, and its common instance if already
+    // built, while other threads carry on retrieving it (see "Notes on
+    // redeclaration").
+    template <typename Func>
+    static void redeclare (Func&& bldr) {
+      instance()->redeclare(declaration(std::forward<Func>(bldr), Lifetime::shared));
+    }
+
+    template <typename Func>
+    static void declare_unique (Func&& bldr) {
+      declare_as(std::forward<Func>(bldr), Lifetime::unique);
+    }
+
+    // Declare a unique dependency built as a Concrete from copies of 'args'.
+    // Naming the class lets get_unique_n() lay its instances out contiguously.
+    template <typename Concrete, typename... Args>
+    static void declare_unique_of (Args&&... args) {
+      Declaration decl = declaration(Internals::construct_with<Dep, Concrete>(args...),
+                                     Lifetime::unique);
+      decl.placement = Internals::Placement<Dep>::template of<Concrete>(
+        std::forward<Args>(args)...);
+      instance()->declare(decl);
+    }
+
+    // Declare a unique dependency whose released instances are recycled.  'reset'
+    // (optional) restores a released instance to a freshly built state; at most
+    // 'max_idle' released instances are kept in the common pool.
+    template <typename Func>
+    static void declare_pooled (Func&& bldr,
+                                typename Builder::ResetFunc reset = nullptr,
+                                std::size_t max_idle = 1024) {
+      Declaration decl = declaration(std::forward<Func>(bldr), Lifetime::pooled);
+      decl.reset    = reset;
+      decl.max_idle = max_idle;
+      instance()->declare(decl);
+    }
+
+    // Declare a shared dependency, as by declare(), and start building it at once on a
+    // background thread (see "Notes on asynchronous building").
+    template <typename Func>
+    static void declare_async (Func&& bldr) {
+      declare(std::forward<Func>(bldr));
+      instance()->get_async();
+    }
+
+    // The shared instance, as a future, building it in the background if it is
+    // neither built nor being built.
+    static std::shared_future<Dep*> get_async ( ) {
+      return get_async(IsBound());
+    }
+
+    // Let shutdown(ShutdownMode::fast_exit) leave this type+tag's common instance
+    // undestroyed, as one whose destructor does nothing the process needs at exit.
+    static void mark_abandonable ( ) {
+      instance()->mark_abandonable();
+    }
+
+    // Declare that this type+tag's builder retrieves OtherDep+OtherTag.  prewarm()
+    // then builds that first, and a dependency cycle is refused here rather than
+    // discovered in get().
+    template <typename OtherDep, typename OtherTag = DefaultTag>
+    static void depends_on ( ) {
+      Internals::registry().depend(instance(), Factory<OtherDep, OtherTag>::instance());
+    }
+
+    // Declare a dependency of which each thread gets its own instance from get(),
+    // built on the thread's first get() and destroyed when the thread exits.
+    template <typename Func>
+    static void declare_thread_local (Func&& bldr) {
+      declare_as(std::forward<Func>(bldr), Lifetime::per_thread);
+    }
+
+    // Declare a dependency of which each Scope gets its own Concrete instance from
+    // get(), constructed in the Scope's arena from copies of 'args'.
+    template <typename Concrete, typename... Args>
+    static void declare_scoped (Args&&... args) {
+      Declaration decl = declaration(Internals::construct_with<Dep, Concrete>(args...),
+                                     Lifetime::scoped);
+      decl.placement = Internals::Placement<Dep>::template of<Concrete>(
+        std::forward<Args>(args)...);
+      instance()->declare(decl);
+    }
+
+    // Declare a shared dependency whose instance, a Concrete constructed with copies of
+    // 'args', is built in place in DepInject's static storage for such instances,
+    // beside the others (see "Notes on in-place instances").
+    template <typename Concrete, typename... Args>
+    static void declare_inplace (Args&&... args) {
+      Declaration decl = declaration(Internals::construct_with<Dep, Concrete>(args...),
+                                     Lifetime::shared);
+      decl.placement = Internals::Placement<Dep>::template of<Concrete>(
+        std::forward<Args>(args)...);
+      instance()->declare(decl);
+    }
+
+    // Declare a dependency with one instance per CPU, each a Concrete constructed with
+    // copies of 'args'.  get() returns the instance of the CPU it runs on; all are
+    // built together, on the first get(), and live until shutdown().
+    template <typename Concrete, typename... Args>
+    static void declare_per_cpu (Args&&... args) {
+      Declaration decl = declaration(Internals::construct_with<Dep, Concrete>(args...),
+                                     Lifetime::per_cpu);
+      decl.placement = Internals::Placement<Dep>::template of<Concrete>(
+        std::forward<Args>(args)...);
+      instance()->declare(decl);
+    }
+
+    // Call 'visitor' with each CPU's instance of a per-CPU declaration, unless none
+    // are built yet.  get() may go on using the instances meanwhile.
+    template <typename Visitor>
+    static void visit_per_cpu (Visitor visitor) {
+      instance()->visit_per_cpu(visitor);
+    }
+
+    // Fold every CPU's instance of a per-CPU declaration into 'init', as
+    // init = op(init, instance).
+    template <typename T, typename Op>
+    static T reduce_per_cpu (T init, Op op) {
+      auto fold = [&init, &op](Dep& dep) { init = op(std::move(init), dep); };
+      instance()->visit_per_cpu(fold);
+      return init;
+    }
+
+    static Dep* get ( ) {
+      return get_common(IsBound());
+    }
+
+    // Declare one shared instance per run-time key, each built by 'bldr' (called with
+    // its key) on that key's first get(key).  A nonzero 'max_keys' limits the keys
+    // served (see "Notes on keyed declarations").
+    template <typename Key, typename Func>
+    static void declare_keyed (Func&& bldr, std::size_t max_keys = 0) {
+      static_assert(!IsBound::value, "DepInject: declare: type+tag is bound at compile time");
+      keyed_instance<Key>()->declare(
+        typename Internals::KeyedBuilder<Dep, Tag, Key>::BuildFunc(std::forward<Func>(bldr)),
+        max_keys);
+    }
 
-#ifndef NOON_DEPINJECT_H
+    // The shared instance for 'key', of a declare_keyed<Key>() declaration.
+    template <typename Key>
+    static Dep* get (Key const& key) {
+      return keyed_instance<Key>()->get(key);
+    }
+
+    // How many keys of a declare_keyed<Key>() declaration have instances.
+    template <typename Key>
+    static std::size_t keyed_count ( ) {
+      return keyed_instance<Key>()->keys();
+    }
+
+    static Dep* get_unique ( ) {
+      auto builder = instance();
+      return builder->get(true);
+    }
+
+    static UniquePtr<Dep> get_unique_ptr ( ) {
+      auto builder = instance();
+      return builder->get_handle();
+    }
+
+    // As get() and get_unique(), but returning failure as an Error rather than
+    // throwing it (see "Notes on error handling").
+    static Result<Dep> try_get ( ) noexcept {
+      return try_get(IsBound());
+    }
+
+    static Result<Dep> try_get_unique ( ) noexcept {
+      auto builder = instance();
+      return builder->try_get(true);
+    }
+
+    // Retrieve 'n' unique instances at once.  Those of a declare_unique_of<>()
+    // declaration share one contiguous block, freed once all are released.
+    static std::vector<UniquePtr<Dep>> get_unique_n (std::size_t n) {
+      auto builder = instance();
+      return builder->get_handles(n);
+    }
+
+    static void testing_reset ( ) {
+      // This function is for testing DepInject itself.  Not for general use.
+      auto builder = instance();
+      builder->testing_reset();
+    }
+
+  private:
+    template <typename, typename> friend class Factory;
+
+    // Every declaration, in whatever form, is made here (or by declare_keyed()), so
+    // that a type+tag bound at compile time, whose get() never reads one, refuses all.
+    template <typename Func>
+    static Declaration declaration (Func&& bldr, Lifetime life) {
+      static_assert(!IsBound::value, "DepInject: declare: type+tag is bound at compile time");
+      Declaration decl;
+      decl.builder  = typename Builder::BuildFunc(std::forward<Func>(bldr));
+      decl.lifetime = life;
+      return decl;
+    }
+
+    template <typename Func>
+    static void declare_as (Func&& bldr, Lifetime life) {
+      instance()->declare(declaration(std::forward<Func>(bldr), life));
+    }
+
+    // (Templates, so that only the overload get() calls is instantiated, even by an
+    // explicit instantiation of the Factory.)
+    template <typename Bound = IsBound>
+    static Dep* get_common (std::true_type) {
+      return &bound<Dep, Tag>();
+    }
+
+    template <typename Bound = IsBound>
+    static Dep* get_common (std::false_type) {
+      auto builder = instance();
+      return builder->get(false);
+    }
+
+    template <typename Bound = IsBound>
+    static std::shared_future<Dep*> get_async (std::true_type) {
+      return Builder::ready(&bound<Dep, Tag>());
+    }
+
+    template <typename Bound = IsBound>
+    static std::shared_future<Dep*> get_async (std::false_type) {
+      auto builder = instance();
+      return builder->get_async();
+    }
+
+    template <typename Bound = IsBound>
+    static Result<Dep> try_get (std::true_type) noexcept {
+      return &bound<Dep, Tag>();
+    }
+
+    template <typename Bound = IsBound>
+    static Result<Dep> try_get (std::false_type) noexcept {
+      auto builder = instance();
+      return builder->try_get(false);
+    }
+
+    static Builder* instance ( ) {
+      static Builder builder;
+      return &builder;
+    }
+
+    template <typename Key>
+    static Internals::KeyedBuilder<Dep, Tag, Key>* keyed_instance ( ) {
+      static Internals::KeyedBuilder<Dep, Tag, Key> builder;
+      return &builder;
+    }
+  };
+
+
+  template <typename Dep, typename Tag>
+  Dep* get ( ) {
+    return Factory<Dep, Tag>::get();
+  }
+
+  template <typename Dep, typename Tag>
+  Dep* get_unique ( ) {
+    return Factory<Dep, Tag>::get_unique();
+  }
+
+  template <typename Dep, typename Tag>
+  UniquePtr<Dep> get_unique_ptr ( ) {
+    return Factory<Dep, Tag>::get_unique_ptr();
+  }
+
+
+  template <typename Dep, typename Tag>
+  Dep* Scope::get ( ) {
+    Scope* outer = current();
+    current() = this;
+    struct Restore {
+      Scope* outer;
+      ~Restore ( ) { current() = outer; }
+    } restore {outer};
+    return Factory<Dep, Tag>::get();
+  }
+
+
+  // This function is for testing code.  Not for general use.
+  // Reset every Factory<>, as if by its testing_reset(), at once: each Builder
+  // clears its state (destroying its instances) on its next use.
+  inline void testing_reset_all ( ) {
+    Internals::Generation<>::current.fetch_add(1, std::memory_order_relaxed);
+    for (Internals::BuilderBase* b : Internals::registry().snapshot())
+      b->unpublish();
+  }
+
+
+  //
+  //  Prewarming: build every declared shared instance up front.
+  //
+  struct BuildTime {
+    std::string              dependency;   // the interface type's name
+    std::string              tag;          // the tag type's name
+    std::chrono::nanoseconds elapsed;      // time spent in the builder
+  };
+
+  // Build all declared, not yet built, shared instances, using up to 'nthreads'
+  // threads, and report how long each took.  Instances are built after those they
+  // depend_on(); independent ones are built concurrently.  If any builder fails,
+  // the first exception is rethrown once the rest have been built.
+  inline std::vector<BuildTime> prewarm (unsigned nthreads = 1) {
+    Internals::Registry::Graph graph = Internals::registry().graph();
+    std::vector<BuildTime>   timings;
+    std::mutex               mutex;            // guards 'timings'
+    Internals::walk_graph(graph.dependents, graph.dependency_count, nthreads,
+                          [&](std::size_t i) {
+      Internals::BuilderBase*  node = graph.nodes[i];
+      std::chrono::nanoseconds elapsed {0};
+      if (node->prewarm(elapsed)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        timings.push_back(BuildTime{node->dependency_name(), node->tag_name(), elapsed});
+      }
+    });
+    return timings;
+  }
+
+
+  //
+  //  Shutdown: destroy the shared instances in a known order, before static
+  //  destruction would.
+  //
+  enum class ShutdownMode {
+    orderly,        // destroy every shared instance
+    fast_exit,      // ...except those marked abandonable, which are left as they are
+  };
+
+  // Destroy all shared instances (and idle pooled ones), each before whatever it
+  // depends on, and return how many were destroyed.  With one thread, instances
+  // are destroyed in the reverse of the order in which they were built; with more,
+  // each once all that depend_on() it, whose builders built or waited for it, or
+  // whose builds began after it was built, are gone, independent ones concurrently.
+  // Shared instances may not be retrieved again afterwards.  Instances replaced by
+  // redeclare() are reclaimed first.
+  inline std::size_t shutdown (ShutdownMode mode = ShutdownMode::orderly,
+                               unsigned nthreads = 1) {
+    reclaim();
+    bool                       fast  = mode == ShutdownMode::fast_exit;
+    Internals::Registry::Graph graph = Internals::registry().graph();
+    std::atomic<std::size_t>   destroyed {0};
+    auto destroy = [&](std::size_t i) {
+      if (graph.nodes[i]->shut_down(fast))
+        destroyed.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    if (nthreads <= 1) {
+      // Reverse build order, which any dependency resolved by a builder follows.
+      std::vector<std::pair<std::uint64_t, std::size_t>> order;
+      for (std::size_t i = 0; i < graph.nodes.size(); ++i)
+        order.emplace_back(graph.nodes[i]->built_at(), i);
+      std::sort(order.begin(), order.end());
+      for (auto o = order.rbegin(); o != order.rend(); ++o)
+        destroy(o->second);
+    }
+    else {
+      // The declared edges, those seen while building that agree with the build
+      // order, and one from each instance to every instance built before its build
+      // began (which its builder may have retrieved unseen, from the fast path), so
+      // that no instance goes before one whose builder retrieved it.
+      std::size_t                n = graph.nodes.size();
+      std::vector<std::uint64_t> stamps(n), began(n);
+      std::vector<std::size_t>   built;
+      for (std::size_t i = 0; i < n; ++i) {
+        stamps[i] = graph.nodes[i]->built_at();
+        began[i]  = graph.nodes[i]->began_at();
+        if (stamps[i] != 0)
+          built.push_back(i);
+      }
+      for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t d : graph.used[i]) {
+          if (stamps[d] != 0 && stamps[d] < stamps[i])
+            graph.add(i, d);
+        }
+      }
+      std::sort(built.begin(), built.end(),
+                [&](std::size_t a, std::size_t b) { return stamps[a] < stamps[b]; });
+      for (std::size_t i : built) {
+        // Leave out instances built before another that was itself built before i
+        // began: the edge through that one implies them.
+        std::uint64_t implied = 0;
+        for (std::size_t d : built) {
+          if (stamps[d] >= began[i])
+            break;
+          implied = std::max(implied, began[d]);
+        }
+        for (std::size_t d : built) {
+          if (stamps[d] >= began[i])
+            break;
+          if (stamps[d] > implied)
+            graph.add(i, d);
+        }
+      }
+      std::vector<std::size_t> waiting(graph.nodes.size());
+      for (std::size_t i = 0; i < graph.nodes.size(); ++i)
+        waiting[i] = graph.dependents[i].size();
+      Internals::walk_graph(graph.dependencies, waiting, nthreads, destroy);
+    }
+    return destroyed.load();
+  }
+
+
+#ifdef DEPINJECT_METRICS
+  //
+  //  Metrics: a snapshot of one declared type+tag's instrumentation.
+  //
+  struct FactoryMetrics {
+    std::string   dependency;      // the interface type's name
+    std::string   tag;             // the tag type's name
+    std::uint64_t gets;            // get() calls
+    std::uint64_t unique_gets;     // get_unique() and get_unique_ptr() calls
+    std::uint64_t builds;          // builder invocations...
+    std::uint64_t failures;        // ...of which threw or returned nothing
+
+    // build_latency[i]: builds taking [2^i, 2^(i+1)) ns (see Internals::Metrics).
+    std::array<std::uint64_t, Internals::Metrics::latency_buckets> build_latency;
+  };
+
+  inline std::vector<FactoryMetrics> metrics_snapshot ( ) {
+    std::vector<FactoryMetrics> snapshot;
+    for (Internals::BuilderBase* b : Internals::registry().snapshot()) {
+      Internals::Metrics const& m = b->metrics;
+      FactoryMetrics fm;
+      fm.dependency  = b->dependency_name();
+      fm.tag         = b->tag_name();
+      fm.gets        = m.total_gets(false);
+      fm.unique_gets = m.total_gets(true);
+      fm.builds      = m.builds.load(std::memory_order_relaxed);
+      fm.failures    = m.failures.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < fm.build_latency.size(); ++i)
+        fm.build_latency[i] = m.latency[i].load(std::memory_order_relaxed);
+      snapshot.push_back(fm);
+    }
+    return snapshot;
+  }
+#endif
+
+
+  //
+  //  Build traces: a record of every builder invocation between start_build_trace()
+  //  and stop_build_trace(), such as those made during startup.
+  //
+  struct BuildEvent {
+    static constexpr std::size_t none = Internals::Tracer::none;
+
+    std::string              dependency;   // the interface type's name
+    std::string              tag;          // the tag type's name
+    unsigned                 thread;       // numbered from 0, in order of first build
+    std::chrono::nanoseconds start;        // since start_build_trace()
+    std::chrono::nanoseconds end;
+    std::size_t              parent;       // the event whose builder called get(), or none
+    bool                     finished;     // before stop_build_trace()...
+    bool                     failed;       // ...by throwing or returning nothing
+
+    std::chrono::nanoseconds duration ( ) const { return end - start; }
+  };
+
+  namespace Internals
+  {
+    // 'text' escaped for a JSON (or DOT) string.
+    inline std::string escaped (std::string const& text) {
+      static char const hex[] = "0123456789abcdef";
+      std::string q;
+      for (char c : text) {
+        if (c == '"' || c == '\\')
+          q += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+          q += "\\u00";
+          q += hex[(c >> 4) & 0xf];
+          q += hex[c & 0xf];
+        }
+        else
+          q += c;
+      }
+      return q;
+    }
+
+    inline std::string quoted (std::string const& text) {
+      return '"' + escaped(text) + '"';
+    }
+
+    // 'ns' in microseconds, to the nanosecond.
+    inline std::string micros (std::chrono::nanoseconds ns) {
+      if (ns.count() < 0)
+        ns = std::chrono::nanoseconds(0);
+      std::string frac = std::to_string(1000 + ns.count() % 1000);
+      return std::to_string(ns.count() / 1000) + "." + frac.substr(1);
+    }
+
+  } // Internals
+
+  class BuildTrace {
+  public:
+    std::vector<BuildEvent> events;         // in order of starting
+
+    // "Interface [Tag]", naming the type+tag event 'i' built.
+    std::string name (std::size_t i) const {
+      return events[i].dependency + " [" + events[i].tag + "]";
+    }
+
+    // Event i's time spent in its own builder, not in those it called upon.
+    std::chrono::nanoseconds self_time (std::size_t i) const {
+      std::chrono::nanoseconds self = events[i].duration();
+      for (BuildEvent const& e : events) {
+        if (e.parent == i)
+          self -= e.duration();
+      }
+      return self;
+    }
+
+    // The heaviest chain of nested builds: the longest top-level build, the longest
+    // build it called upon, and so on.  Its events' self_time()s are where that
+    // build's time went.
+    std::vector<std::size_t> critical_path ( ) const {
+      std::vector<std::size_t> path;
+      std::size_t              parent = BuildEvent::none;
+      for (;;) {
+        std::size_t longest = BuildEvent::none;
+        for (std::size_t i = 0; i < events.size(); ++i) {
+          if (events[i].parent == parent &&
+              (longest == BuildEvent::none || events[i].duration() > events[longest].duration()))
+            longest = i;
+        }
+        if (longest == BuildEvent::none)
+          return path;
+        path.push_back(longest);
+        parent = longest;
+      }
+    }
+
+    // The trace in Chrome's trace-event format, for chrome://tracing or Perfetto.
+    std::string chrome_trace ( ) const {
+      std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+      for (std::size_t i = 0; i < events.size(); ++i) {
+        BuildEvent const& e = events[i];
+        json += i ? ",\n  " : "\n  ";
+        json += "{\"name\": " + Internals::quoted(name(i)) +
+                ", \"cat\": \"build\", \"ph\": \"X\", \"pid\": 1, \"tid\": " +
+                std::to_string(e.thread) + ", \"ts\": " + Internals::micros(e.start) +
+                ", \"dur\": " + Internals::micros(e.duration()) + ", \"args\": {\"parent\": " +
+                (e.parent == BuildEvent::none ? "null" : Internals::quoted(name(e.parent))) +
+                ", \"self_us\": " + Internals::micros(self_time(i)) +
+                ", \"finished\": " + (e.finished ? "true" : "false") +
+                ", \"failed\": " + (e.failed ? "true" : "false") + "}}";
+      }
+      return json + "\n]}\n";
+    }
+
+    // The resolution graph in Graphviz DOT: a node for each type+tag built, an edge
+    // from each to those its builder called upon, the critical path in red.
+    std::string dot_graph ( ) const {
+      struct Node {
+        std::string              name;
+        std::size_t              builds {0};
+        std::chrono::nanoseconds total  {0};
+        bool                     critical {false};
+      };
+      std::vector<Node>        nodes;
+      std::vector<std::size_t> node_of(events.size());
+      for (std::size_t i = 0; i < events.size(); ++i) {
+        std::string n = name(i);
+        std::size_t k = 0;
+        while (k < nodes.size() && nodes[k].name != n)
+          ++k;
+        if (k == nodes.size())
+          nodes.push_back(Node{n});
+        ++nodes[k].builds;
+        nodes[k].total += events[i].duration();
+        node_of[i] = k;
+      }
+
+      // Edges, as (from, to) -> (calls, critical).
+      std::vector<std::pair<std::pair<std::size_t, std::size_t>,
+                            std::pair<std::size_t, bool>>> edges;
+      std::vector<std::size_t> path = critical_path();
+      auto on_path = [&path](std::size_t i) {
+        return std::find(path.begin(), path.end(), i) != path.end();
+      };
+      for (std::size_t i = 0; i < events.size(); ++i) {
+        if (on_path(i))
+          nodes[node_of[i]].critical = true;
+        if (events[i].parent == BuildEvent::none)
+          continue;
+        auto key = std::make_pair(node_of[events[i].parent], node_of[i]);
+        auto e   = std::find_if(edges.begin(), edges.end(),
+                                [&key](decltype(edges[0]) const& edge) { return edge.first == key; });
+        if (e == edges.end())
+          e = edges.insert(edges.end(), std::make_pair(key, std::make_pair(std::size_t(0), false)));
+        ++e->second.first;
+        e->second.second = e->second.second || on_path(i);
+      }
+
+      std::string dot = "digraph depinject {\n  node [shape=box];\n";
+      for (std::size_t k = 0; k < nodes.size(); ++k) {
+        dot += "  n" + std::to_string(k) + " [label=\"" + Internals::escaped(nodes[k].name) +
+               "\\n" + std::to_string(nodes[k].builds) +
+               (nodes[k].builds == 1 ? " build, " : " builds, ") +
+               Internals::micros(nodes[k].total) + " us\"" +
+               (nodes[k].critical ? ", color=red" : "") + "];\n";
+      }
+      for (auto const& e : edges) {
+        dot += "  n" + std::to_string(e.first.first) + " -> n" + std::to_string(e.first.second) +
+               " [label=\"" + std::to_string(e.second.first) + "\"" +
+               (e.second.second ? ", color=red" : "") + "];\n";
+      }
+      return dot + "}\n";
+    }
+  };
+
+  // Begin recording builder invocations, discarding any earlier trace.
+  inline void start_build_trace ( ) {
+    Internals::tracer().start();
+  }
+
+  // Stop recording, returning the trace.
+  inline BuildTrace stop_build_trace ( ) {
+    auto                 stopped = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point began;
+    auto                 records = Internals::tracer().stop(began);
+    BuildTrace           trace;
+    for (auto const& r : records) {
+      BuildEvent e;
+      e.dependency = r.builder->dependency_name();
+      e.tag        = r.builder->tag_name();
+      e.thread     = r.thread;
+      e.start      = r.start - began;
+      e.finished   = r.end >= r.start;
+      e.end        = (e.finished ? r.end : stopped) - began;
+      e.parent     = r.parent;
+      e.failed     = e.finished && r.failed;
+      trace.events.push_back(e);
+    }
+    return trace;
+  }
+
+  // Helper functions, for the simplest cases.  Each build of Concrete is passed
+  // copies of 'args'.
+  template <typename Dep, typename Concrete, typename Tag = DefaultTag, typename... Args>
+  void basic_declaration (Args&&... args) {
+    Factory<Dep, Tag>::declare(
+      Internals::construct_with<Dep, Concrete>(std::forward<Args>(args)...));
+  }
+
+  template <typename Dep, typename Concrete, typename Tag = DefaultTag, typename... Args>
+  void basic_unique_declaration (Args&&... args) {
+    Factory<Dep, Tag>::template declare_unique_of<Concrete>(std::forward<Args>(args)...);
+  }
+
+
+  //
+  //  A name used in config-driven wiring, with its 64-bit FNV-1a hash.  A Name made
+  //  from a string literal in a constant expression is hashed at compile time; one
+  //  made from text read at run time just refers to that text, copying nothing.
+  //
+  class Name {
+  public:
+    // A string literal (the array's final character being its terminator).
+    template <std::size_t N>
+    constexpr Name (char const (&literal)[N]) : Name(literal, N - 1) { }
+
+    constexpr Name (char const* text, std::size_t length)
+      : m_text(text), m_length(length), m_hash(hash(text, length)) { }
+
+    Name (std::string const& text) : Name(text.data(), text.size()) { }
+
+    constexpr char const*   text ( ) const { return m_text; }
+    constexpr std::size_t   length ( ) const { return m_length; }
+    constexpr std::uint64_t hash ( ) const { return m_hash; }
+
+    std::string str ( ) const { return std::string(m_text, m_length); }
+
+    static constexpr std::uint64_t hash (char const* text, std::size_t length) {
+      std::uint64_t h = 0xcbf29ce484222325ull;
+      for (std::size_t i = 0; i < length; ++i) {
+        h ^= static_cast<unsigned char>(text[i]);
+        h *= 0x100000001b3ull;
+      }
+      return h;
+    }
+
+  private:
+    char const*   m_text;
+    std::size_t   m_length;
+    std::uint64_t m_hash;
+  };
 
-#include <memory>
-#include <stdexcept>
-#include <string>
 
-namespace DepInject
-{
   namespace Internals
   {
+    // A distinct address for each type, standing in for RTTI's type identity.
+    template <typename T>
+    void const* type_key ( ) {
+      static char const key {0};
+      return &key;
+    }
+
     //
-    //  A Builder object can build dependencies.
+    //  A map from Names to owned Values: a flat, open-addressed table probed
+    //  linearly from each name's hash, kept at most half full.  Lookups compare
+    //  hashes first and allocate nothing.
     //
-    template <typename Dep>
-    class Builder {
+    template <typename Value>
+    class NameTable {
     public:
-      using BuildFunc = Dep* (*)();
+      std::size_t size ( ) const { return count; }
 
-      void declare (BuildFunc bldr, bool uniq) {
-        if (builder)
-          throw std::logic_error("DepInject: declare: redeclaration for same type+tag");
-        if (!bldr)
-          throw std::logic_error("DepInject: declare: no allocation function provided");
-        builder = bldr;
-        unique  = uniq;
+      // Add 'value' under 'name'; false, leaving the table as it was, if the name
+      // is already present.
+      bool insert (Name name, std::unique_ptr<Value> value) {
+        if (find(name))
+          return false;
+        if (2 * (count + 1) > entries.size())
+          grow();
+        Entry& e = probe(entries, name.hash());
+        e.hash  = name.hash();
+        e.name  = name.str();
+        e.value = std::move(value);
+        ++count;
+        return true;
       }
 
-      Dep* get (bool uniq) {
-        // Status checks.
-        if (!builder) {
-          throw std::logic_error("DepInject: get: object type+tag not declared");
-        }
-        if (uniq != unique) {
-          std::string qualif {unique ? "non-" : ""};
-          throw std::logic_error("DepInject: get: "
-                                 "request for " + qualif +
-                                 "unique instance doesn't match declaration");
+      Value* find (Name name) const {
+        if (entries.empty())
+          return nullptr;
+        std::size_t mask = entries.size() - 1;
+        for (std::size_t i = name.hash() & mask; entries[i].value; i = (i + 1) & mask) {
+          Entry const& e = entries[i];
+          if (e.hash == name.hash() &&
+              e.name.compare(0, std::string::npos, name.text(), name.length()) == 0)
+            return e.value.get();
         }
+        return nullptr;
+      }
 
-        // Call the user-supplied builder function.
-        Dep* dep = nullptr;
-        if (unique)
-          dep = builder();
-        else {
-          if (!common_instance)
-            common_instance.reset(builder());
-          dep = common_instance.get();
-        }
+    private:
+      struct Entry {
+        std::uint64_t          hash {0};
+        std::string            name;
+        std::unique_ptr<Value> value;       // empty if the entry is free
+      };
 
-        // Return the results.
-        // Note that we have no 'dep' to clean up if there's a problem.
-        // If the builder() threw an exception (say, memory allocation failure),
-        // then we won't be getting this far anyway.
-        if (dep)
-          return dep;
-        else
-          throw std::runtime_error("DepInject: get: object allocation failed");
+      // The first free entry probed from 'hash'.
+      static Entry& probe (std::vector<Entry>& table, std::uint64_t hash) {
+        std::size_t mask = table.size() - 1;
+        std::size_t i    = hash & mask;
+        while (table[i].value)
+          i = (i + 1) & mask;
+        return table[i];
       }
 
-      void testing_reset ( ) {
-        // This function for testing DepInject itself.  Not for general use.
-        // It reinitializes the Builder singleton, clearing its state.
-        builder = nullptr;
-        common_instance.reset();
-        unique = false;
+      void grow ( ) {
+        std::vector<Entry> larger(entries.empty() ? 16 : 2 * entries.size());
+        for (Entry& e : entries) {
+          if (e.value)
+            probe(larger, e.hash) = std::move(e);
+        }
+        entries.swap(larger);
       }
 
-    private:
-      BuildFunc            builder {nullptr};
-      std::unique_ptr<Dep> common_instance;
-      bool                 unique  {false};
+      std::vector<Entry> entries;           // a power of two in size
+      std::size_t        count {0};
     };
 
   } // Internals
 
 
   //
-  //  Builders work in (singleton) Factories.
-  //  DepInject users only call Factory<Dep> methods.
+  //  Config-driven wiring.  Interface+tag pairs ("slots") and the builders able to
+  //  fill them ("implementations") are registered under names; wire() then declares
+  //  a slot's Factory<> with a named implementation, so that the choice can come
+  //  from a configuration file rather than from code naming both types.
   //
-  struct DefaultTag { };
-
-  template <typename Dep, typename Tag = DefaultTag>
-  class Factory {
-    using Builder = Internals::Builder<Dep>;
-
+  class Wiring {
   public:
-    Factory() = default;
-    Factory(Factory const&) = delete;
-    Factory& operator=(Factory const&) = delete;
+    Wiring() = default;
+    Wiring(Wiring const&) = delete;
+    Wiring& operator=(Wiring const&) = delete;
 
-    static void declare (typename Builder::BuildFunc bldr) {
-      auto builder = instance();
-      builder->declare(bldr, false);
+    // Register Factory<Dep, Tag> under 'name', to be declared shared when wired.
+    template <typename Dep, typename Tag = DefaultTag>
+    void add_slot (Name name) {
+      add(slots, name, std::unique_ptr<SlotBase>(new Slot<Dep, Tag>(false)), "slot");
     }
 
-    static void declare_unique (typename Builder::BuildFunc bldr) {
-      auto builder = instance();
-      builder->declare(bldr, true);
+    // Register Factory<Dep, Tag> under 'name', to be declared unique when wired.
+    template <typename Dep, typename Tag = DefaultTag>
+    void add_unique_slot (Name name) {
+      add(slots, name, std::unique_ptr<SlotBase>(new Slot<Dep, Tag>(true)), "slot");
     }
 
-    static Dep* get ( ) {
-      auto builder = instance();
-      return builder->get(false);
+    // Register, under 'name', an implementation of Dep built as a Concrete from
+    // copies of 'args'.
+    template <typename Dep, typename Concrete, typename... Args>
+    void add_implementation (Name name, Args&&... args) {
+      add_builder<Dep>(name, Internals::construct_with<Dep, Concrete>(
+                               std::forward<Args>(args)...));
     }
 
-    static Dep* get_unique ( ) {
-      auto builder = instance();
-      return builder->get(true);
+    // Register, under 'name', an implementation of Dep built by 'bldr'.
+    template <typename Dep, typename Func>
+    void add_builder (Name name, Func&& bldr) {
+      add(implementations, name,
+          std::unique_ptr<ImplementationBase>(
+            new Implementation<Dep>(std::forward<Func>(bldr))),
+          "implementation");
     }
 
-    static void testing_reset ( ) {
-      // This function is for testing DepInject itself.  Not for general use.
-      auto builder = instance();
-      builder->testing_reset();
+    // Declare the slot called 'slot' with the implementation called 'impl'.
+    void wire (Name slot, Name impl) {
+      std::lock_guard<std::mutex> lock(mutex);
+      SlotBase*           s = slots.find(slot);
+      ImplementationBase* i = implementations.find(impl);
+      if (!s)
+        Internals::fail<std::runtime_error>("DepInject: wire: no slot named '" + slot.str() + "'");
+      if (!i)
+        Internals::fail<std::runtime_error>("DepInject: wire: no implementation named '" +
+                                            impl.str() + "'");
+      if (s->interface != i->interface)
+        Internals::fail<std::logic_error>("DepInject: wire: implementation '" + impl.str() +
+                                          "' does not fit slot '" + slot.str() + "'");
+      s->declare(*i);
+    }
+
+    // Wire each "slot = implementation" line of 'config'.  Blank lines, and those
+    // beginning with '#', are skipped; surrounding blanks are ignored.  Returns the
+    // number of slots wired.
+    std::size_t wire_config (std::string const& config) {
+      std::size_t wired = 0;
+      std::size_t line  = 0;
+      for (std::size_t pos = 0; pos < config.size(); ) {
+        std::size_t end = config.find('\n', pos);
+        if (end == std::string::npos)
+          end = config.size();
+        ++line;
+        char const* first = config.data() + pos;
+        char const* last  = config.data() + end;
+        pos = end + 1;
+
+        trim(first, last);
+        if (first == last || *first == '#')
+          continue;
+        char const* equals = first;
+        while (equals != last && *equals != '=')
+          ++equals;
+        char const* slot_end   = equals;
+        char const* impl_first = equals == last ? last : equals + 1;
+        trim(first, slot_end);
+        trim(impl_first, last);
+        if (equals == last || first == slot_end || impl_first == last)
+          Internals::fail<std::runtime_error>("DepInject: wire: line " + std::to_string(line) +
+                                              ": expected 'slot = implementation'");
+        wire(Name(first, static_cast<std::size_t>(slot_end - first)),
+             Name(impl_first, static_cast<std::size_t>(last - impl_first)));
+        ++wired;
+      }
+      return wired;
     }
 
   private:
-    static Builder* instance ( ) {
-      static Builder builder;
-      return &builder;
+    struct ImplementationBase {
+      explicit ImplementationBase (void const* iface) : interface(iface) { }
+      virtual ~ImplementationBase() = default;
+      void const* interface;
+    };
+
+    template <typename Dep>
+    struct Implementation final : ImplementationBase {
+      template <typename Func>
+      explicit Implementation (Func&& bldr)
+        : ImplementationBase(Internals::type_key<Dep>()), builder(std::forward<Func>(bldr)) { }
+      Internals::InlineFunction<Dep*()> builder;
+    };
+
+    struct SlotBase {
+      SlotBase (void const* iface, bool uniq) : interface(iface), unique(uniq) { }
+      virtual ~SlotBase() = default;
+      virtual void declare (ImplementationBase const& impl) const = 0;
+      void const* interface;
+      bool        unique;
+    };
+
+    template <typename Dep, typename Tag>
+    struct Slot final : SlotBase {
+      explicit Slot (bool uniq) : SlotBase(Internals::type_key<Dep>(), uniq) { }
+
+      // 'impl' is known to implement Dep.
+      void declare (ImplementationBase const& impl) const override {
+        auto const& builder = static_cast<Implementation<Dep> const&>(impl).builder;
+        if (unique)
+          Factory<Dep, Tag>::declare_unique(builder);
+        else
+          Factory<Dep, Tag>::declare(builder);
+      }
+    };
+
+    template <typename Value>
+    void add (Internals::NameTable<Value>& table, Name name,
+              std::unique_ptr<Value> value, char const* kind) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!table.insert(name, std::move(value)))
+        Internals::fail<std::logic_error>(std::string("DepInject: wiring: ") + kind + " '" +
+                                          name.str() + "' already registered");
+    }
+
+    static void trim (char const*& first, char const*& last) {
+      while (first != last && (*first == ' ' || *first == '\t' || *first == '\r'))
+        ++first;
+      while (last != first && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+        --last;
     }
-  };
 
+    std::mutex                                 mutex;
+    Internals::NameTable<SlotBase>             slots;
+    Internals::NameTable<ImplementationBase>   implementations;
+  };
 
-  // A helper function, for the simplest cases.
-  template <typename Dep, typename Concrete, typename Tag = DefaultTag>
-  void basic_declaration() {
-    Factory<Dep, Tag>::declare([]() -> Dep* {return new Concrete;});
+  // The program's Wiring.
+  inline Wiring& wiring ( ) {
+    static Wiring w;
+    return w;
   }
 
 } // DepInject
 
+
+// Bind a type+tag to a concrete class at compile time.  Use at global scope.
+#define DEPINJECT_BIND(Dep, Tag, Concrete)                  \
+  namespace DepInject {                                     \
+    template <>                                             \
+    struct Binding<Dep, Tag> {                              \
+      static constexpr bool bound = true;                   \
+      using type = Concrete;                                \
+    };                                                      \
+  }
+
+// Declare, in every compilation unit using it, that a type+tag's Factory<> is
+// instantiated once, by DEPINJECT_INSTANTIATE_FACTORY(), rather than in each.  Use at
+// global scope, after any DEPINJECT_BIND() of the type+tag.
+#define DEPINJECT_EXTERN_FACTORY(Dep, Tag)                               \
+  namespace DepInject {                                                  \
+    extern template class Internals::Builder<Dep, Tag>;                  \
+    extern template class Factory<Dep, Tag>;                             \
+    extern template Dep* get<Dep, Tag>();                                \
+    extern template Dep* get_unique<Dep, Tag>();                         \
+    extern template UniquePtr<Dep> get_unique_ptr<Dep, Tag>();           \
+  }
+
+// Instantiate a type+tag's Factory<> explicitly.  Use at global scope, in exactly one
+// compilation unit.
+#define DEPINJECT_INSTANTIATE_FACTORY(Dep, Tag)                          \
+  namespace DepInject {                                                  \
+    template class Internals::Builder<Dep, Tag>;                         \
+    template class Factory<Dep, Tag>;                                    \
+    template Dep* get<Dep, Tag>();                                       \
+    template Dep* get_unique<Dep, Tag>();                                \
+    template UniquePtr<Dep> get_unique_ptr<Dep, Tag>();                  \
+  }
+
+#ifdef DEPINJECT_STATIC_WIRING
+#include DEPINJECT_STATIC_WIRING
+#endif
+
 #endif  // NOON_DEPINJECT_H
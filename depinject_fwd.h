@@ -0,0 +1,184 @@
+// depinject_fwd.h -- DepInject declarations for code that only retrieves dependencies
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+//================================================================================
+
+
+// Notes on this header:
+//
+//     * Code that only retrieves dependencies needs none of depinject.h's machinery.
+//       Including this header instead, it may call DepInject::get<Dep, Tag>(),
+//       get_unique<>() and get_unique_ptr<>(), and hold a UniquePtr<>, for any
+//       type+tag explicitly instantiated elsewhere with DEPINJECT_INSTANTIATE_FACTORY()
+//       (see "Notes on explicit instantiation" in depinject.h).  So may a Lazy<> handle.
+//
+//     * With DEPINJECT_STATIC_WIRING defined, this header includes depinject.h after
+//       all, as bound objects are only devirtualized where their bindings are seen.
+
+#ifndef NOON_DEPINJECT_FWD_H
+#define NOON_DEPINJECT_FWD_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+// Keep a function out of line, and out of the way of the hot path calling it.
+#if defined(__GNUC__)
+#define DEPINJECT_COLD __attribute__((noinline, cold))
+#else
+#define DEPINJECT_COLD
+#endif
+
+// Whether exceptions are enabled (see "Notes on error handling" in depinject.h).
+#ifndef DEPINJECT_EXCEPTIONS
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define DEPINJECT_EXCEPTIONS 1
+#else
+#define DEPINJECT_EXCEPTIONS 0
+#endif
+#endif
+
+namespace DepInject
+{
+  struct DefaultTag;
+
+  template <typename Dep, typename Tag = DefaultTag>
+  class Factory;
+
+  namespace Internals
+  {
+    //
+    //  Report a failure by throwing an E, or, without exceptions, by printing its
+    //  message and aborting.  Kept out of line, away from the paths that call it.
+    //
+    template <typename E>
+    [[noreturn]] DEPINJECT_COLD void fail (char const* what) {
+#if DEPINJECT_EXCEPTIONS
+      throw E(what);
+#else
+      std::fprintf(stderr, "%s\n", what);
+      std::abort();
+#endif
+    }
+
+    //
+    //  A Disposer releases an instance handed out by get_unique_ptr().  By default it
+    //  deletes the instance; pooled instances are instead returned to their Builder.
+    //
+    template <typename Dep>
+    class Disposer {
+    public:
+      using DisposeFunc = void (*)(Dep*, void* context, std::uintptr_t cookie);
+
+      Disposer() = default;
+      Disposer(DisposeFunc func, void* ctx, std::uintptr_t cook)
+        : dispose(func), context(ctx), cookie(cook) { }
+
+      void operator() (Dep* dep) const {
+        if (dispose)
+          dispose(dep, context, cookie);
+        else
+          delete dep;
+      }
+
+    private:
+      DisposeFunc    dispose {nullptr};
+      void*          context {nullptr};
+      std::uintptr_t cookie  {0};
+    };
+
+  } // Internals
+
+
+  //
+  //  An owning handle for a unique instance.  Pooled instances return to their
+  //  pool when the handle is destroyed; others are deleted.
+  //
+  template <typename Dep>
+  using UniquePtr = std::unique_ptr<Dep, Internals::Disposer<Dep>>;
+
+
+  // Factory<Dep, Tag>::get(), get_unique() and get_unique_ptr(), as free functions
+  // that need not see the Factory.
+  template <typename Dep, typename Tag = DefaultTag>
+  Dep* get ( );
+
+  template <typename Dep, typename Tag = DefaultTag>
+  Dep* get_unique ( );
+
+  template <typename Dep, typename Tag = DefaultTag>
+  UniquePtr<Dep> get_unique_ptr ( );
+
+
+  //
+  //  A handle to a shared dependency, retrieved by get<Dep, Tag>() on first use
+  //  rather than when the handle is constructed.  Resolving is thread-safe: racing
+  //  first users all find the one shared instance.  Thereafter each use costs a
+  //  load and a branch.
+  //
+  template <typename Dep, typename Tag = DefaultTag>
+  class Lazy {
+  public:
+    Lazy ( ) noexcept = default;
+
+    Lazy (Lazy const& other) noexcept
+      : instance(other.instance.load(std::memory_order_acquire)) { }
+
+    Lazy& operator= (Lazy const& other) noexcept {
+      instance.store(other.instance.load(std::memory_order_acquire),
+                     std::memory_order_release);
+      return *this;
+    }
+
+    Dep* get ( ) const {
+      if (Dep* dep = instance.load(std::memory_order_acquire))
+        return dep;
+      return resolve();
+    }
+
+    Dep& operator* ( ) const { return *get(); }
+    Dep* operator-> ( ) const { return get(); }
+
+    // Whether the dependency has been retrieved yet.
+    bool resolved ( ) const noexcept {
+      return instance.load(std::memory_order_acquire) != nullptr;
+    }
+
+  private:
+    DEPINJECT_COLD Dep* resolve ( ) const {
+      Dep* dep = DepInject::get<Dep, Tag>();
+      instance.store(dep, std::memory_order_release);
+      return dep;
+    }
+
+    mutable std::atomic<Dep*> instance {nullptr};
+  };
+
+} // DepInject
+
+#ifdef DEPINJECT_STATIC_WIRING
+#include "depinject.h"
+#endif
+
+#endif  // NOON_DEPINJECT_FWD_H
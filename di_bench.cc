@@ -0,0 +1,827 @@
+// di_bench.cc -- DepInject benchmark driver
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+
+#include "di_bulbs.h"
+#include "di_lamps.h"
+#include "di_loggers.h"
+#include "depinject.h"
+#include "di_factories.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+
+// A bulb which is quiet to construct, and whose calls can be inlined once devirtualized.
+class QuietBulb final : public IBulb {
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  bool m_is_lit {false};
+};
+
+// Tags for QuietBulb resolved at run time and bound at compile time, respectively.
+struct QuietTag { };
+struct BoundTag { };
+
+DEPINJECT_BIND(IBulb, BoundTag, QuietBulb)
+
+// A bulb slow to destroy, as one saving its state would be, and tags for many of them.
+class SlowBulb final : public IBulb {
+public:
+  ~SlowBulb ( ) { std::this_thread::sleep_for(std::chrono::microseconds(200)); }
+
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  bool m_is_lit {false};
+};
+
+template <std::size_t N>
+struct SlowTag { };
+
+// A tag for a bulb slow to build, as a connection pool or large table would be.
+struct SlowStartTag { };
+
+// Tags for many shared bulbs, built on the heap or in place.
+template <std::size_t N>
+struct HeapTag { };
+
+template <std::size_t N>
+struct InplaceTag { };
+
+// A statistics collector, as a server counting its requests would keep.
+class ICounter {
+public:
+  virtual ~ICounter() = default;
+  virtual void add (long n) = 0;
+  virtual long total ( ) const = 0;
+};
+
+class Counter final : public ICounter {
+public:
+  void add (long n) override { m_total.fetch_add(n, std::memory_order_relaxed); }
+  long total ( ) const override { return m_total.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<long> m_total {0};
+};
+
+// Tags for a Counter shared by every thread, and for one per CPU.
+struct SharedCountTag { };
+struct CpuCountTag { };
+
+//-------------------------------------------------------------------------
+// Note: Output is a single JSON document on stdout (or the file named by
+//       "-o FILE"), so that results can be archived and compared across
+//       releases.  The lamp and bulb classes log to std::cout, through
+//       the declared ILogger; that stream is pointed at a null buffer while
+//       benchmarks run.
+//-------------------------------------------------------------------------
+
+namespace {
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Result {
+    std::string   name;
+    unsigned      threads;
+    unsigned long iterations;
+    double        ns_per_op;
+  };
+
+
+  // escape:
+  //   Make the compiler assume 'p' is used, so benchmark loops are not optimized away.
+  inline void
+  escape (void const* p)
+  {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(p) : "memory");
+#else
+    static void const* volatile sink;
+    sink = p;
+#endif
+  }
+
+
+  // A stream buffer discarding everything written to it.
+  class NullBuffer : public std::streambuf {
+  protected:
+    int_type overflow (int_type ch) override { return traits_type::not_eof(ch); }
+    std::streamsize xsputn (char const*, std::streamsize n) override { return n; }
+  };
+
+
+  // time_loop:
+  //   Run 'body' 'iterations' times (after one warm-up call) on the calling thread,
+  //   returning the mean nanoseconds per call.
+  template <typename Body>
+  double
+  time_loop (unsigned long iterations, Body body)
+  {
+    body();
+    auto start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+      body();
+    auto stop = Clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+  }
+
+
+  // time_threads:
+  //   Run time_loop() on 'nthreads' threads started together, returning the mean
+  //   nanoseconds per call as seen by each thread.
+  template <typename Body>
+  double
+  time_threads (unsigned nthreads, unsigned long iterations, Body body)
+  {
+    std::atomic<unsigned>    ready {0};
+    std::atomic<bool>        go    {false};
+    std::vector<double>      ns(nthreads);
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 0; t < nthreads; ++t) {
+      threads.emplace_back([&, t]() {
+        ready.fetch_add(1);
+        while (!go.load())
+          ;
+        ns[t] = time_loop(iterations, body);
+      });
+    }
+    while (ready.load() != nthreads)
+      ;
+    go.store(true);
+    for (auto& th : threads)
+      th.join();
+
+    double total = 0;
+    for (double n : ns)
+      total += n;
+    return total / nthreads;
+  }
+
+
+  void
+  reset_bulb_factories ( )
+  {
+    DepInject::Factory<IBulb           >::testing_reset();
+    DepInject::Factory<IBulb, UniqueTag>::testing_reset();
+    DepInject::Factory<IBulb, GaudyTag >::testing_reset();
+    DepInject::Factory<IBulb, QuietTag >::testing_reset();
+    DepInject::Factory<ILogger         >::testing_reset();
+  }
+
+
+  // Declare Dep+Tag shared, built by 'bldr', unless di_wiring.h binds it (under
+  // STATIC_WIRING), when declare() would not compile.
+  template <typename Dep, typename Tag, typename Func>
+  void
+  declare_unbound (Func&&, std::true_type)
+  {
+  }
+
+  template <typename Dep, typename Tag, typename Func>
+  void
+  declare_unbound (Func&& bldr, std::false_type)
+  {
+    DepInject::Factory<Dep, Tag>::declare(std::forward<Func>(bldr));
+  }
+
+  template <typename Dep, typename Tag = DepInject::DefaultTag, typename Func>
+  void
+  declare_unbound (Func&& bldr)
+  {
+    declare_unbound<Dep, Tag>(std::forward<Func>(bldr),
+                              std::integral_constant<bool, DepInject::Binding<Dep, Tag>::bound>());
+  }
+
+
+  void
+  declare_bulb_factories ( )
+  {
+    // Under STATIC_WIRING the logger and shared bulbs are bound by di_wiring.h instead.
+    reset_bulb_factories();
+    declare_unbound<ILogger>([]() -> ILogger* {return new AsyncLogger(cout);});
+    declare_unbound<IBulb>([]() -> IBulb* {return new Bulb;});
+    DepInject::Factory<IBulb, UniqueTag>::declare_unique([]() -> IBulb* {return new Bulb;});
+    declare_unbound<IBulb, GaudyTag>([]() -> IBulb* {return new GaudyBulb;});
+    DepInject::basic_declaration<IBulb, QuietBulb, QuietTag>();
+  }
+
+
+  // Declare and build a QuietBulb for each HeapTag<N> on the heap, with other
+  // allocations between them as a program's startup would make, and one for each
+  // InplaceTag<N> in place.
+  template <std::size_t... N>
+  void
+  build_heap_and_inplace_bulbs (std::index_sequence<N...>,
+                                std::vector<std::unique_ptr<char[]>>& clutter)
+  {
+    int expand[] = {0, (DepInject::Factory<IBulb, HeapTag<N>>::declare(
+                          []() -> IBulb* {return new QuietBulb;}),
+                        escape(DepInject::Factory<IBulb, HeapTag<N>>::get()),
+                        clutter.emplace_back(new char[4096]),
+                        DepInject::Factory<IBulb, InplaceTag<N>>::template declare_inplace<QuietBulb>(),
+                        escape(DepInject::Factory<IBulb, InplaceTag<N>>::get()), 0)...};
+    static_cast<void>(expand);
+  }
+
+
+  // Switch every Tag<N>'s shared bulb.
+  template <template <std::size_t> class Tag, std::size_t... N>
+  void
+  electrify_bulbs (std::index_sequence<N...>, bool on)
+  {
+    int expand[] = {0, (DepInject::Factory<IBulb, Tag<N>>::get()->electrified(on), 0)...};
+    static_cast<void>(expand);
+  }
+
+
+  // Declare and build a SlowBulb for each SlowTag<N>.
+  template <std::size_t... N>
+  void
+  build_slow_bulbs (std::index_sequence<N...>, bool abandonable)
+  {
+    int expand[] = {0, (DepInject::Factory<IBulb, SlowTag<N>>::testing_reset(),
+                        DepInject::Factory<IBulb, SlowTag<N>>::declare(
+                          []() -> IBulb* {return new SlowBulb;}),
+                        abandonable ? DepInject::Factory<IBulb, SlowTag<N>>::mark_abandonable()
+                                    : void(),
+                        escape(DepInject::Factory<IBulb, SlowTag<N>>::get()), 0)...};
+    static_cast<void>(expand);
+  }
+
+
+  // A replica of Factory<>::instance(), to price the function-local static guard alone.
+  struct GuardedObject { int value {0}; };
+
+  GuardedObject*
+  guarded_instance ( )
+  {
+    static GuardedObject object;
+    return &object;
+  }
+
+
+  void
+  print_json (std::ostream& out, std::vector<Result> const& results)
+  {
+    out << "{\n"
+        << "  \"context\": {\n"
+#if defined(__VERSION__)
+        << "    \"compiler\": \"" << __VERSION__ << "\",\n"
+#endif
+        << "    \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "\n"
+        << "  },\n"
+        << "  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      Result const& r = results[i];
+      out << "    {\"name\": \"" << r.name << "\", "
+          << "\"threads\": " << r.threads << ", "
+          << "\"iterations\": " << r.iterations << ", "
+          << "\"ns_per_op\": " << r.ns_per_op << "}"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}\n";
+  }
+
+} // anonymous namespace
+
+
+int
+main (int argc, char* argv[])
+{
+  std::string filter;
+  std::string outfile;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      outfile = argv[++i];
+    else if (argv[i][0] != '-')
+      filter = argv[i];
+    else {
+      std::cerr << "usage: " << argv[0] << " [-o FILE] [NAME-SUBSTRING]\n";
+      return 2;
+    }
+  }
+
+  unsigned max_threads = std::thread::hardware_concurrency();
+  if (max_threads == 0)
+    max_threads = 1;
+
+  // Silence the lamps and bulbs while timing.
+  NullBuffer       null_buffer;
+  std::streambuf*  cout_buffer = cout.rdbuf(&null_buffer);
+  std::vector<Result> results;
+
+  auto bench = [&](std::string const& name, unsigned threads, unsigned long iterations,
+                   double ns_per_op) {
+    results.push_back(Result{name, threads, iterations, ns_per_op});
+  };
+  auto wanted = [&](std::string const& name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+  };
+
+  declare_bulb_factories();
+
+  if (wanted("function_local_static")) {
+    const unsigned long n = 50000000;
+    bench("function_local_static", 1, n, time_loop(n, []() { escape(guarded_instance()); }));
+  }
+
+  if (wanted("get_shared")) {
+    const unsigned long n = 50000000;
+    bench("get_shared", 1, n,
+          time_loop(n, []() { escape(DepInject::Factory<IBulb>::get()); }));
+  }
+
+  if (wanted("try_get_shared")) {
+    const unsigned long n = 50000000;
+    bench("try_get_shared", 1, n,
+          time_loop(n, []() { escape(DepInject::Factory<IBulb>::try_get().get()); }));
+  }
+
+  if (wanted("get_shared_pinned")) {
+    const unsigned long n = 50000000;
+    bench("get_shared_pinned", 1, n, time_loop(n, []() {
+      DepInject::Pin pin;
+      escape(DepInject::Factory<IBulb>::get());
+    }));
+  }
+
+  if (wanted("get_bound")) {
+    const unsigned long n = 50000000;
+    bench("get_bound", 1, n,
+          time_loop(n, []() { escape(DepInject::Factory<IBulb, BoundTag>::get()); }));
+  }
+
+  if (wanted("electrify_runtime")) {
+    const unsigned long n = 50000000;
+    bool on = false;
+    bench("electrify_runtime", 1, n, time_loop(n, [&on]() {
+      IBulb& bulb = *DepInject::Factory<IBulb, QuietTag>::get();
+      bulb.electrified(on = !on);
+      escape(&bulb);
+    }));
+  }
+
+  if (wanted("electrify_bound")) {
+    const unsigned long n = 50000000;
+    bool on = false;
+    bench("electrify_bound", 1, n, time_loop(n, [&on]() {
+      QuietBulb& bulb = DepInject::bound<IBulb, BoundTag>();
+      bulb.electrified(on = !on);
+      escape(&bulb);
+    }));
+  }
+
+  // Switch 64 shared bulbs, scattered about the heap or side by side in place.
+  if (wanted("electrify_64_")) {
+    const unsigned long n = 1000000;
+    const std::size_t   count = 64;
+    std::vector<std::unique_ptr<char[]>> clutter;
+    build_heap_and_inplace_bulbs(std::make_index_sequence<count>(), clutter);
+    bool on = false;
+    bench("electrify_64_heap", 1, n * count, time_loop(n, [&on]() {
+      electrify_bulbs<HeapTag>(std::make_index_sequence<count>(), on = !on);
+    }) / count);
+    bench("electrify_64_inplace", 1, n * count, time_loop(n, [&on]() {
+      electrify_bulbs<InplaceTag>(std::make_index_sequence<count>(), on = !on);
+    }) / count);
+
+    // The same, timing only passes made after evicting the caches, as a program
+    // whose other work crowds its singletons out would make them.
+    const unsigned long passes = 200;
+    std::vector<char>   crowd(64 << 20);
+    auto cold = [&](char const* name, void (*pass)(bool)) {
+      double ns = 0;
+      for (unsigned long i = 0; i < passes; ++i) {
+        for (std::size_t b = 0; b < crowd.size(); b += 64)
+          crowd[b] = static_cast<char>(i);
+        escape(crowd.data());
+        auto start = Clock::now();
+        pass(on = !on);
+        ns += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      }
+      bench(name, 1, passes * count, ns / (passes * count));
+    };
+    cold("electrify_64_heap_cold", [](bool on) {
+      electrify_bulbs<HeapTag>(std::make_index_sequence<count>(), on);
+    });
+    cold("electrify_64_inplace_cold", [](bool on) {
+      electrify_bulbs<InplaceTag>(std::make_index_sequence<count>(), on);
+    });
+  }
+
+  if (wanted("get_contended")) {
+    const unsigned long n = 10000000;
+    for (unsigned t = 1; t <= max_threads; ++t)
+      bench("get_contended", t, n,
+            time_threads(t, n, []() { escape(DepInject::Factory<IBulb>::get()); }));
+  }
+
+  if (wanted("get_thread_local")) {
+    struct ThreadTag { };
+    DepInject::Factory<IBulb, ThreadTag>::declare_thread_local(
+      []() -> IBulb* {return new QuietBulb;});
+    const unsigned long n = 10000000;
+    for (unsigned t = 1; t <= max_threads; ++t)
+      bench("get_thread_local", t, n, time_threads(t, n, []() {
+        IBulb* bulb = DepInject::Factory<IBulb, ThreadTag>::get();
+        bulb->electrified(!bulb->is_lit());
+      }));
+    DepInject::Factory<IBulb, ThreadTag>::testing_reset();
+  }
+
+  if (wanted("get_keyed")) {
+    struct KeyedTag { };
+    using KeyedFactory = DepInject::Factory<IBulb, KeyedTag>;
+    const unsigned keys = 1024;
+    KeyedFactory::declare_keyed<unsigned>([](unsigned const&) -> IBulb* {return new QuietBulb;});
+    for (unsigned key = 0; key < keys; ++key)
+      escape(KeyedFactory::get(key));
+    const unsigned long n = 10000000;
+    for (unsigned t = 1; t <= max_threads; ++t) {
+      std::atomic<unsigned> next {0};
+      bench("get_keyed", t, n, time_threads(t, n, [&next]() {
+        thread_local unsigned key = next.fetch_add(97, std::memory_order_relaxed);
+        key = (key + 1) % keys;
+        escape(KeyedFactory::get(key));
+      }));
+    }
+  }
+
+  // Count from every thread, into one shared counter and into per-CPU counters.
+  if (wanted("counter_")) {
+    using SharedCounter = DepInject::Factory<ICounter, SharedCountTag>;
+    using CpuCounter    = DepInject::Factory<ICounter, CpuCountTag>;
+    SharedCounter::declare([]() -> ICounter* {return new Counter;});
+    CpuCounter::declare_per_cpu<Counter>();
+    const unsigned long n = 10000000;
+    for (unsigned t = 1; t <= max_threads; ++t) {
+      if (wanted("counter_shared"))
+        bench("counter_shared", t, n, time_threads(t, n, []() { SharedCounter::get()->add(1); }));
+      if (wanted("counter_per_cpu"))
+        bench("counter_per_cpu", t, n, time_threads(t, n, []() { CpuCounter::get()->add(1); }));
+    }
+    if (wanted("counter_per_cpu")) {
+      const unsigned long reductions = 100000;
+      long total = 0;
+      bench("counter_per_cpu_reduce", 1, reductions, time_loop(reductions, [&total]() {
+        total = CpuCounter::reduce_per_cpu(0L, [](long sum, ICounter& c) {
+          return sum + c.total();
+        });
+        escape(&total);
+      }));
+    }
+    SharedCounter::testing_reset();
+    CpuCounter::testing_reset();
+  }
+
+  if (wanted("get_unique_bulb")) {
+    const unsigned long n = 2000000;
+    bench("get_unique_bulb", 1, n, time_loop(n, []() {
+      std::unique_ptr<IBulb> bulb {DepInject::Factory<IBulb, UniqueTag>::get_unique()};
+      escape(bulb.get());
+    }));
+  }
+
+  // The same, with every build recorded in a build trace.
+  if (wanted("get_unique_bulb_traced")) {
+    const unsigned long n = 200000;
+    DepInject::start_build_trace();
+    bench("get_unique_bulb_traced", 1, n, time_loop(n, []() {
+      std::unique_ptr<IBulb> bulb {DepInject::Factory<IBulb, UniqueTag>::get_unique()};
+      escape(bulb.get());
+    }));
+    DepInject::stop_build_trace();
+  }
+
+  if (wanted("get_unique_gaudy_bulb")) {
+    struct GaudyUniqueTag { };
+    DepInject::Factory<IBulb, GaudyUniqueTag>::declare_unique(
+      []() -> IBulb* {return new GaudyBulb;});
+    const unsigned long n = 2000000;
+    bench("get_unique_gaudy_bulb", 1, n, time_loop(n, []() {
+      std::unique_ptr<IBulb> bulb {DepInject::Factory<IBulb, GaudyUniqueTag>::get_unique()};
+      escape(bulb.get());
+    }));
+    DepInject::Factory<IBulb, GaudyUniqueTag>::testing_reset();
+  }
+
+  if (wanted("get_unique_stateful")) {
+    struct StatefulTag { };
+    Bulb prototype;
+    DepInject::Factory<IBulb, StatefulTag>::declare_unique(
+      [prototype]() -> IBulb* {return new Bulb(prototype);});
+    const unsigned long n = 2000000;
+    bench("get_unique_stateful", 1, n, time_loop(n, []() {
+      std::unique_ptr<IBulb> bulb {DepInject::Factory<IBulb, StatefulTag>::get_unique()};
+      escape(bulb.get());
+    }));
+    DepInject::Factory<IBulb, StatefulTag>::testing_reset();
+  }
+
+  // Set up, light and release 1000 unique bulbs, one by one and as one batch.
+  // ns_per_op is per bulb.
+  if (wanted("unique_1000_each")) {
+    struct EachTag { };
+    DepInject::Factory<IBulb, EachTag>::declare_unique([]() -> IBulb* {return new QuietBulb;});
+    const unsigned long n = 2000;
+    double ns = time_loop(n, []() {
+      std::vector<DepInject::UniquePtr<IBulb>> bulbs;
+      bulbs.reserve(1000);
+      for (int i = 0; i < 1000; ++i)
+        bulbs.push_back(DepInject::Factory<IBulb, EachTag>::get_unique_ptr());
+      for (auto& bulb : bulbs)
+        bulb->electrified(true);
+      escape(bulbs.data());
+    });
+    bench("unique_1000_each", 1, n * 1000, ns / 1000);
+    DepInject::Factory<IBulb, EachTag>::testing_reset();
+  }
+
+  if (wanted("unique_1000_batched")) {
+    struct BatchTag { };
+    DepInject::Factory<IBulb, BatchTag>::declare_unique_of<QuietBulb>();
+    const unsigned long n = 2000;
+    double ns = time_loop(n, []() {
+      auto bulbs = DepInject::Factory<IBulb, BatchTag>::get_unique_n(1000);
+      for (auto& bulb : bulbs)
+        bulb->electrified(true);
+      escape(bulbs.data());
+    });
+    bench("unique_1000_batched", 1, n * 1000, ns / 1000);
+    DepInject::Factory<IBulb, BatchTag>::testing_reset();
+  }
+
+  // Light every other bulb of 4096, as separate bulbs and as a BulbBank; then count
+  // those lit.  ns_per_op is per bulb.
+  if (wanted("bulbs_4096_electrify_each") || wanted("bulbs_4096_electrify_bank") ||
+      wanted("bulbs_4096_count_each")    || wanted("bulbs_4096_count_bank")) {
+    const std::size_t count = 4096;
+    std::vector<std::unique_ptr<IBulb>> bulbs;
+    for (std::size_t i = 0; i < count; ++i)
+      bulbs.emplace_back(new Bulb);
+    BulbBank bank(count);
+    std::vector<BulbBank::Word> mask(bank.words(), 0x5555555555555555ull);
+    const unsigned long n = 20000;
+
+    if (wanted("bulbs_4096_electrify_each")) {
+      double ns = time_loop(n, [&bulbs]() {
+        for (std::size_t i = 0; i < bulbs.size(); i += 2)
+          bulbs[i]->electrified(true);
+        escape(bulbs.data());
+      });
+      bench("bulbs_4096_electrify_each", 1, n * count, ns / count);
+    }
+    if (wanted("bulbs_4096_electrify_bank")) {
+      double ns = time_loop(n, [&bank, &mask]() {
+        bank.electrify(mask, true);
+        escape(&bank);
+      });
+      bench("bulbs_4096_electrify_bank", 1, n * count, ns / count);
+    }
+    if (wanted("bulbs_4096_count_each")) {
+      double ns = time_loop(n, [&bulbs]() {
+        std::size_t lit = 0;
+        for (auto const& bulb : bulbs)
+          lit += bulb->is_lit();
+        escape(&lit);
+      });
+      bench("bulbs_4096_count_each", 1, n * count, ns / count);
+    }
+    if (wanted("bulbs_4096_count_bank")) {
+      double ns = time_loop(n, [&bank]() {
+        std::size_t lit = bank.count_lit();
+        escape(&lit);
+      });
+      bench("bulbs_4096_count_bank", 1, n * count, ns / count);
+    }
+  }
+
+  if (wanted("get_unique_ptr_pooled")) {
+    struct PooledTag { };
+    DepInject::Factory<IBulb, PooledTag>::declare_pooled([]() -> IBulb* {return new Bulb;});
+    const unsigned long n = 2000000;
+    bench("get_unique_ptr_pooled", 1, n, time_loop(n, []() {
+      auto bulb = DepInject::Factory<IBulb, PooledTag>::get_unique_ptr();
+      escape(bulb.get());
+    }));
+    DepInject::Factory<IBulb, PooledTag>::testing_reset();
+  }
+
+  if (wanted("request_")) {
+    // A request wiring three per-request bulbs: scoped versus unique.
+    struct ScopedA { };  struct ScopedB { };  struct ScopedC { };
+    struct UniqueA { };  struct UniqueB { };  struct UniqueC { };
+    DepInject::Factory<IBulb, ScopedA>::declare_scoped<QuietBulb>();
+    DepInject::Factory<IBulb, ScopedB>::declare_scoped<QuietBulb>();
+    DepInject::Factory<IBulb, ScopedC>::declare_scoped<QuietBulb>();
+    DepInject::Factory<IBulb, UniqueA>::declare_unique([]() -> IBulb* {return new QuietBulb;});
+    DepInject::Factory<IBulb, UniqueB>::declare_unique([]() -> IBulb* {return new QuietBulb;});
+    DepInject::Factory<IBulb, UniqueC>::declare_unique([]() -> IBulb* {return new QuietBulb;});
+    const unsigned long n = 2000000;
+    if (wanted("request_scoped"))
+      bench("request_scoped", 1, n, time_loop(n, []() {
+        DepInject::Scope scope;
+        escape(DepInject::Factory<IBulb, ScopedA>::get());
+        escape(DepInject::Factory<IBulb, ScopedB>::get());
+        escape(DepInject::Factory<IBulb, ScopedC>::get());
+      }));
+    if (wanted("request_unique"))
+      bench("request_unique", 1, n, time_loop(n, []() {
+        auto a = DepInject::Factory<IBulb, UniqueA>::get_unique_ptr();
+        auto b = DepInject::Factory<IBulb, UniqueB>::get_unique_ptr();
+        auto c = DepInject::Factory<IBulb, UniqueC>::get_unique_ptr();
+        escape(a.get());  escape(b.get());  escape(c.get());
+      }));
+    DepInject::Factory<IBulb, ScopedA>::testing_reset();
+    DepInject::Factory<IBulb, ScopedB>::testing_reset();
+    DepInject::Factory<IBulb, ScopedC>::testing_reset();
+    DepInject::Factory<IBulb, UniqueA>::testing_reset();
+    DepInject::Factory<IBulb, UniqueB>::testing_reset();
+    DepInject::Factory<IBulb, UniqueC>::testing_reset();
+  }
+
+  if (wanted("declare")) {
+    // Each iteration must undo the previous declaration; report the pair.
+    struct DeclareTag { };
+    const unsigned long n = 5000000;
+    bench("declare_and_reset", 1, n, time_loop(n, []() {
+      DepInject::Factory<IBulb, DeclareTag>::declare([]() -> IBulb* {return new Bulb;});
+      DepInject::Factory<IBulb, DeclareTag>::testing_reset();
+    }));
+
+    // The same, resetting every Factory<> at once (as a test suite would between
+    // cases), with the next declare() clearing the stale Builder.  The shared bulb
+    // factories are declared again afterwards.
+    bench("declare_and_reset_all", 1, n, time_loop(n, []() {
+      DepInject::Factory<IBulb, DeclareTag>::declare([]() -> IBulb* {return new Bulb;});
+      DepInject::testing_reset_all();
+    }));
+    declare_bulb_factories();
+  }
+
+  if (wanted("wiring_lookup")) {
+    // Resolve names read at run time among 512 registered ones, as wiring from a
+    // configuration file does for each line.
+    DepInject::Internals::NameTable<int> table;
+    std::vector<std::string>             names;
+    for (int i = 0; i < 512; ++i) {
+      names.push_back("com.example.service" + std::to_string(i) + ".bulb");
+      table.insert(names.back(), std::unique_ptr<int>(new int(i)));
+    }
+    const unsigned long n = 10000000;
+    std::size_t         i = 0;
+    bench("wiring_lookup_512", 1, n, time_loop(n, [&]() {
+      escape(table.find(names[i++ & 511]));
+    }));
+  }
+
+  if (wanted("construct_lamp")) {
+    const unsigned long n = 1000000;
+    bench("construct_lamp", 1, n, time_loop(n, []() { Lamp lamp; escape(&lamp); }));
+  }
+
+  if (wanted("construct_lamp_with_unique_bulb")) {
+    const unsigned long n = 1000000;
+    bench("construct_lamp_with_unique_bulb", 1, n,
+          time_loop(n, []() { LampWithUniqueBulb lamp; escape(&lamp); }));
+  }
+
+  if (wanted("construct_gaudy_lamp")) {
+    const unsigned long n = 1000000;
+    bench("construct_gaudy_lamp", 1, n, time_loop(n, []() { GaudyLamp lamp; escape(&lamp); }));
+  }
+
+  if (wanted("construct_lazy_lamp")) {
+    const unsigned long n = 1000000;
+    bench("construct_lazy_lamp", 1, n, time_loop(n, []() { LazyLamp lamp; escape(&lamp); }));
+  }
+
+  if (wanted("get_lazy_resolved")) {
+    const unsigned long n = 50000000;
+    DepInject::Lazy<IBulb> lazy;
+    lazy.get();
+    bench("get_lazy_resolved", 1, n, time_loop(n, [&lazy]() { escape(lazy.get()); }));
+  }
+
+  // Toggle a lamp, logging each toggle to a file synchronously (as the lamps once
+  // did with std::endl) and through the asynchronous logger.
+  if (!DepInject::Binding<ILogger>::bound) {
+    std::ofstream sink("/dev/null");
+    auto toggle_lamp = [&](char const* name, auto logger) {
+      if (!wanted(name))
+        return;
+      DepInject::Factory<ILogger>::testing_reset();
+      declare_unbound<ILogger>(logger);
+      {
+        Lamp lamp;
+        const unsigned long n = 2000000;
+        bench(name, 1, n, time_loop(n, [&lamp]() { lamp.toggle_switch(); }));
+      }
+      DepInject::Factory<ILogger>::testing_reset();
+    };
+    toggle_lamp("toggle_lamp_stream_logger", [&sink]() -> ILogger* {return new StreamLogger(sink);});
+    toggle_lamp("toggle_lamp_async_logger",  [&sink]() -> ILogger* {return new AsyncLogger(sink);});
+  }
+
+  // A startup that declares a dependency taking 10 ms to build, does 10 ms of other
+  // work, then retrieves it: declared plainly, and declared to build in the background.
+  if (wanted("startup_slow_builder")) {
+    const unsigned long n = 20;
+    using SlowStartFactory = DepInject::Factory<IBulb, SlowStartTag>;
+    auto slow_builder = []() -> IBulb* {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      return new QuietBulb;
+    };
+    auto startup = [&](char const* name, bool async) {
+      double ns = 0;
+      for (unsigned long i = 0; i < n; ++i) {
+        SlowStartFactory::testing_reset();
+        auto start = Clock::now();
+        if (async)
+          SlowStartFactory::declare_async(slow_builder);
+        else
+          SlowStartFactory::declare(slow_builder);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        escape(SlowStartFactory::get());
+        ns += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      }
+      bench(name, 1, n, ns / n);
+    };
+    startup("startup_slow_builder", false);
+    startup("startup_slow_builder_async", true);
+    SlowStartFactory::testing_reset();
+  }
+
+  // Shut down 16 slow-to-destroy instances, one after another, concurrently, and
+  // abandoning them.  (Last, as shutdown() closes every Factory<>.)
+  if (wanted("shutdown")) {
+    const unsigned long n = 20;
+    const std::size_t   count = 16;
+    auto shutdown = [&](char const* name, unsigned threads, DepInject::ShutdownMode mode) {
+      double ns = 0;
+      for (unsigned long i = 0; i < n; ++i) {
+        build_slow_bulbs(std::make_index_sequence<count>(),
+                         mode == DepInject::ShutdownMode::fast_exit);
+        auto start = Clock::now();
+        DepInject::shutdown(mode, threads);
+        ns += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      }
+      bench(name, threads, n * count, ns / (n * count));
+    };
+    shutdown("shutdown_16_slow_orderly", 1, DepInject::ShutdownMode::orderly);
+    shutdown("shutdown_16_slow_orderly", 4, DepInject::ShutdownMode::orderly);
+    shutdown("shutdown_16_slow_fast_exit", 1, DepInject::ShutdownMode::fast_exit);
+  }
+
+  reset_bulb_factories();
+  cout.rdbuf(cout_buffer);
+
+  if (outfile.empty())
+    print_json(cout, results);
+  else {
+    std::ofstream out(outfile);
+    print_json(out, results);
+    if (!out) {
+      std::cerr << argv[0] << ": cannot write " << outfile << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
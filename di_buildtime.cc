@@ -0,0 +1,61 @@
+// di_buildtime.cc -- DepInject build-time benchmark compilation unit
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+
+//-------------------------------------------------------------------------
+// Note: "make buildtime" compiles this file repeatedly, as a typical user
+//       of three factories, in each of three ways:
+//
+//         BUILDTIME_IMPLICIT  includes depinject.h, instantiating them;
+//         BUILDTIME_EXTERN    includes depinject.h and di_factories.h;
+//         BUILDTIME_FWD       includes only depinject_fwd.h.
+//
+//       It is never linked.
+//-------------------------------------------------------------------------
+
+#include "di_bulb_api.h"
+#include "di_lamps.h"
+#include "di_logger_api.h"
+
+#if defined(BUILDTIME_FWD)
+#include "depinject_fwd.h"
+#elif defined(BUILDTIME_EXTERN)
+#include "depinject.h"
+#include "di_factories.h"
+#else
+#include "depinject.h"
+#endif
+
+
+bool
+light_up (bool on)
+{
+  IBulb& bulb = *DepInject::get<IBulb>();
+  IBulb& gaudy = *DepInject::get<IBulb, GaudyTag>();
+  DepInject::UniquePtr<IBulb> spare = DepInject::get_unique_ptr<IBulb, UniqueTag>();
+
+  bulb.electrified(on);
+  gaudy.electrified(on);
+  spare->electrified(on);
+  DepInject::get<ILogger>()->log(on ? "lights on" : "lights off");
+  return bulb.is_lit() && gaudy.is_lit() && spare->is_lit();
+}
@@ -42,10 +42,11 @@ public:
   IBulb(IBulb const&) = delete;
   IBulb& operator=(IBulb const&) = delete;
 
-  // Non-virtual public interface.
-  void electrified(bool receiving_current);
+  // Non-virtual public interface.  (Inline, so that calls through a concrete bulb
+  // type known at compile time can be devirtualized.)
+  void electrified(bool receiving_current) { do_electrified(receiving_current); }
 
-  bool is_lit() const;
+  bool is_lit() const { return do_is_lit(); }
 
 protected:
   // Forbid instantiation of a bare interface class object.
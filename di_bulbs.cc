@@ -22,10 +22,26 @@
 //
 
 #include "di_bulbs.h"
-#include <iostream>
+#include "di_logger_api.h"
+#include "depinject_fwd.h"
+#include <stdexcept>
+#include <string>
 
-using std::cout;
-using std::endl;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+  void
+  log (char const* line)
+  {
+    DepInject::get<ILogger>()->log(line);
+  }
+
+  using DepInject::Internals::fail;
+
+} // namespace
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -39,21 +55,6 @@ IBulb::~IBulb ( )
 { }
 
 
-// Non-virtual public interface.
-void
-IBulb::electrified (bool receiving_current)
-{
-  do_electrified(receiving_current);
-}
-
-
-bool
-IBulb::is_lit ( ) const
-{
-  return do_is_lit();
-}
-
-
 // Protected: forbid instantiation of a bare interface class object.
 IBulb::IBulb ( )
 { }
@@ -67,7 +68,7 @@ IBulb::IBulb ( )
 
 Bulb::Bulb ( )
 {
-  cout << "bulb created\n";
+  log("bulb created");
 }
 
 
@@ -107,7 +108,7 @@ Bulb::do_is_lit ( ) const
 
 GaudyBulb::GaudyBulb ( )
 {
-  cout << "gaudy bulb created\n";
+  log("gaudy bulb created");
 }
 
 
@@ -137,3 +138,218 @@ GaudyBulb::do_is_lit ( ) const
 {
   return m_is_lit;
 }
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//
+//  (concrete) class BulbBank implementation.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+  using Word = BulbBank::Word;
+
+  // Bits [first, last) of a word, 0 <= first < last <= 64.
+  inline Word
+  bit_range (std::size_t first, std::size_t last)
+  {
+    Word upto = (last == BulbBank::word_bits) ? ~Word(0) : (Word(1) << last) - 1;
+    return upto & ~((Word(1) << first) - 1);
+  }
+
+
+  inline void
+  apply (Word& word, Word mask, bool receiving_current)
+  {
+    word = receiving_current ? (word | mask) : (word & ~mask);
+  }
+
+
+  inline std::size_t
+  popcount (Word w)
+  {
+#if defined(__GNUC__)
+    return static_cast<std::size_t>(__builtin_popcountll(w));
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<std::size_t>((w * 0x0101010101010101ull) >> 56);
+#endif
+  }
+
+
+  // Set (or clear) every bit of words [0, n).
+  void
+  fill_words (Word* words, std::size_t n, bool receiving_current)
+  {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    __m128i const value = receiving_current ? _mm_set1_epi32(-1) : _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(words + i), value);
+#endif
+    for (; i < n; ++i)
+      words[i] = receiving_current ? ~Word(0) : Word(0);
+  }
+
+
+  // Set (or clear) in words [0, n) the bits set in 'mask'.
+  void
+  apply_words (Word* words, Word const* mask, std::size_t n, bool receiving_current)
+  {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+      __m128i* w = reinterpret_cast<__m128i*>(words + i);
+      __m128i  m = _mm_loadu_si128(reinterpret_cast<__m128i const*>(mask + i));
+      __m128i  v = _mm_loadu_si128(w);
+      _mm_storeu_si128(w, receiving_current ? _mm_or_si128(v, m) : _mm_andnot_si128(m, v));
+    }
+#endif
+    for (; i < n; ++i)
+      apply(words[i], mask[i], receiving_current);
+  }
+
+
+  // Count the bits set in words [0, n).
+  std::size_t
+  count_words (Word const* words, std::size_t n)
+  {
+    std::size_t count = 0;
+    std::size_t i     = 0;
+#if defined(__SSE2__)
+    // Bit counts per byte, summed per 64-bit lane with psadbw.
+    __m128i const m1    = _mm_set1_epi8(0x55);
+    __m128i const m2    = _mm_set1_epi8(0x33);
+    __m128i const m4    = _mm_set1_epi8(0x0f);
+    __m128i const zero  = _mm_setzero_si128();
+    __m128i       total = zero;
+    for (; i + 2 <= n; i += 2) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(words + i));
+      v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi64(v, 1), m1));
+      v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi64(v, 2), m2));
+      v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi64(v, 4)), m4);
+      total = _mm_add_epi64(total, _mm_sad_epu8(v, zero));
+    }
+    std::uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), total);
+    count = static_cast<std::size_t>(lanes[0] + lanes[1]);
+#endif
+    for (; i < n; ++i)
+      count += popcount(words[i]);
+    return count;
+  }
+
+} // namespace
+
+
+//
+//  BulbBank::View class: one bulb of a bank, as an IBulb.
+//
+class BulbBank::View final : public IBulb {
+public:
+  View (BulbBank& bank, std::size_t index)
+    : m_bank(bank), m_index(index)
+  { }
+
+private:
+  virtual void do_electrified (bool receiving_current) override
+  {
+    m_bank.electrify(m_index, receiving_current);
+  }
+
+  virtual bool do_is_lit ( ) const override
+  {
+    return m_bank.is_lit(m_index);
+  }
+
+  BulbBank&   m_bank;
+  std::size_t m_index;
+};
+
+
+BulbBank::BulbBank (std::size_t count)
+  : m_size(count), m_lit((count + word_bits - 1) / word_bits, 0)
+{
+  DepInject::get<ILogger>()->log("bulb bank of " + std::to_string(count) + " created");
+}
+
+
+void
+BulbBank::electrify (std::size_t index, bool receiving_current)
+{
+  if (index >= m_size)
+    fail<std::out_of_range>("BulbBank: no such bulb");
+  apply(m_lit[index / word_bits], Word(1) << (index % word_bits), receiving_current);
+}
+
+
+bool
+BulbBank::is_lit (std::size_t index) const
+{
+  if (index >= m_size)
+    fail<std::out_of_range>("BulbBank: no such bulb");
+  return (m_lit[index / word_bits] >> (index % word_bits)) & 1;
+}
+
+
+void
+BulbBank::electrify (std::size_t first, std::size_t last, bool receiving_current)
+{
+  if (first > last || last > m_size)
+    fail<std::out_of_range>("BulbBank: bulb range out of bounds");
+  if (first == last)
+    return;
+
+  std::size_t head = first / word_bits;
+  std::size_t tail = (last - 1) / word_bits;
+  if (head == tail) {
+    apply(m_lit[head], bit_range(first % word_bits, (last - 1) % word_bits + 1),
+          receiving_current);
+    return;
+  }
+  apply(m_lit[head], bit_range(first % word_bits, word_bits), receiving_current);
+  fill_words(m_lit.data() + head + 1, tail - head - 1, receiving_current);
+  apply(m_lit[tail], bit_range(0, (last - 1) % word_bits + 1), receiving_current);
+}
+
+
+void
+BulbBank::electrify (std::vector<Word> const& mask, bool receiving_current)
+{
+  if (mask.size() != m_lit.size())
+    fail<std::invalid_argument>("BulbBank: mask does not match bank size");
+  apply_words(m_lit.data(), mask.data(), m_lit.size(), receiving_current);
+
+  // Keep bits beyond the last bulb clear.
+  if (m_size % word_bits)
+    m_lit.back() &= bit_range(0, m_size % word_bits);
+}
+
+
+std::size_t
+BulbBank::count_lit ( ) const
+{
+  return count_words(m_lit.data(), m_lit.size());
+}
+
+
+std::unique_ptr<IBulb>
+BulbBank::view (std::size_t index)
+{
+  if (index >= m_size)
+    fail<std::out_of_range>("BulbBank: no such bulb");
+  return std::unique_ptr<IBulb>(new View(*this, index));
+}
+
+
+IBulb*
+BulbBank::next_view ( )
+{
+  std::size_t index = m_next_view.fetch_add(1, std::memory_order_relaxed);
+  if (index >= m_size)
+    fail<std::out_of_range>("BulbBank: every bulb already has a view");
+  return new View(*this, index);
+}
@@ -24,11 +24,16 @@
 #define NOON_DI_BULBS_H
 
 #include "di_bulb_api.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 //
 //  Bulb class: a concrete class implementing the IBulb interface.
 //
-class Bulb : public IBulb {
+class Bulb final : public IBulb {
 public:
   Bulb();
 
@@ -47,7 +52,7 @@ private:
 //
 //  GaudyBulb class: A second concrete class implementing the IBulb interface.
 //
-class GaudyBulb : public IBulb {
+class GaudyBulb final : public IBulb {
 public:
   GaudyBulb();
 
@@ -63,4 +68,54 @@ private:
 };
 
 
+
+//
+//  BulbBank class: the lit states of many bulbs, packed one bit per bulb, with bulk
+//  operations over them.  Code needing a single bulb gets an IBulb view of one.
+//  A bank is not synchronized: threads sharing one must arrange their own locking.
+//
+class BulbBank final {
+public:
+  using Word = std::uint64_t;
+
+  static constexpr std::size_t word_bits = 64;
+
+  explicit BulbBank(std::size_t count);
+
+  BulbBank(BulbBank const&) = delete;
+  BulbBank& operator=(BulbBank const&) = delete;
+
+  std::size_t size() const { return m_size; }
+
+  // Number of Words in a mask covering the bank.
+  std::size_t words() const { return m_lit.size(); }
+
+  void electrify(std::size_t index, bool receiving_current);
+  bool is_lit(std::size_t index) const;
+
+  // Electrify (or not) bulbs [first, last).
+  void electrify(std::size_t first, std::size_t last, bool receiving_current);
+
+  // Electrify (or not) the bulbs whose bits are set in 'mask', which has words()
+  // entries; bulb i is bit i % word_bits of entry i / word_bits.
+  void electrify(std::vector<Word> const& mask, bool receiving_current);
+
+  std::size_t count_lit() const;
+
+  // A new IBulb standing for bulb 'index'; the caller owns it.  Views must not
+  // outlive the bank.
+  std::unique_ptr<IBulb> view(std::size_t index);
+
+  // A view of the next bulb not yet handed out, for use as a DepInject builder:
+  //   Factory<IBulb, Tag>::declare_unique([&bank]() { return bank.next_view(); });
+  IBulb* next_view();
+
+private:
+  class View;
+
+  std::size_t              m_size;
+  std::vector<Word>        m_lit;
+  std::atomic<std::size_t> m_next_view {0};
+};
+
 #endif // NOON_DI_BULBS_H
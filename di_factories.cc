@@ -0,0 +1,30 @@
+// di_factories.cc -- DepInject test driver factory instantiations
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+
+#include "di_factories.h"
+
+
+DEPINJECT_INSTANTIATE_FACTORY(IBulb, DepInject::DefaultTag)
+DEPINJECT_INSTANTIATE_FACTORY(IBulb, UniqueTag)
+DEPINJECT_INSTANTIATE_FACTORY(IBulb, GaudyTag)
+DEPINJECT_INSTANTIATE_FACTORY(ILogger, DepInject::DefaultTag)
@@ -0,0 +1,44 @@
+// di_factories.h -- DepInject test driver factory instantiation declarations
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+
+#ifndef NOON_DI_FACTORIES_H
+#define NOON_DI_FACTORIES_H
+
+#include "di_bulb_api.h"
+#include "di_lamps.h"
+#include "di_logger_api.h"
+#include "depinject.h"
+
+//-------------------------------------------------------------------------
+// Note: The factories the lamp and bulb classes retrieve from are
+//       instantiated once, in di_factories.cc.  Compilation units that
+//       include depinject.h include this header too, so as not to
+//       instantiate them again.
+//-------------------------------------------------------------------------
+
+DEPINJECT_EXTERN_FACTORY(IBulb, DepInject::DefaultTag)
+DEPINJECT_EXTERN_FACTORY(IBulb, UniqueTag)
+DEPINJECT_EXTERN_FACTORY(IBulb, GaudyTag)
+DEPINJECT_EXTERN_FACTORY(ILogger, DepInject::DefaultTag)
+
+#endif // NOON_DI_FACTORIES_H
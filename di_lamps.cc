@@ -22,12 +22,8 @@
 //
 
 #include "di_lamps.h"
-#include "depinject.h"
 #include <atomic>
-#include <iostream>
-
-using std::cout;
-using std::endl;
+#include <string>
 
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -37,15 +33,16 @@ using std::endl;
 //////////////////////////////////////////////////////////////////////////////////
 
 Lamp::Lamp ( )
-  : m_bulb(*DepInject::Factory<IBulb>::get())
+  : m_bulb(*DepInject::get<IBulb>()),
+    m_log(*DepInject::get<ILogger>())
 {
-  cout << "Lamp #" << lampcount(true) << " created\n";
+  m_log.log("Lamp #" + std::to_string(lampcount(true)) + " created");
 }
 
 
 Lamp::~Lamp ( )
 {
-  cout << "Lamp #" << lampcount() << " destroyed\n";
+  m_log.log("Lamp #" + std::to_string(lampcount()) + " destroyed");
 }
 
 
@@ -54,7 +51,7 @@ Lamp::toggle_switch ()
 {
   m_current_flowing = !m_current_flowing;
   m_bulb.electrified(m_current_flowing);
-  cout << "lamp turned " << (m_bulb.is_lit() ? "on" : "off") << endl;
+  m_log.log(m_bulb.is_lit() ? "lamp turned on" : "lamp turned off");
 }
 
 
@@ -83,15 +80,16 @@ Lamp::lampcount (bool incr)
 //////////////////////////////////////////////////////////////////////////////////
 
 LampWithUniqueBulb::LampWithUniqueBulb ( )
-  : m_bulb(DepInject::Factory<IBulb, UniqueTag>::get_unique())
+  : m_bulb(DepInject::get_unique_ptr<IBulb, UniqueTag>()),
+    m_log(*DepInject::get<ILogger>())
 {
-  cout << "lamp with unique bulb #" << lampcount(true) << " created\n";
+  m_log.log("lamp with unique bulb #" + std::to_string(lampcount(true)) + " created");
 }
 
 
 LampWithUniqueBulb::~LampWithUniqueBulb ( )
 {
-  cout << "lamp with unique bulb #" << lampcount() << " destroyed\n";
+  m_log.log("lamp with unique bulb #" + std::to_string(lampcount()) + " destroyed");
 }
 
 
@@ -100,7 +98,7 @@ LampWithUniqueBulb::toggle_switch ( )
 {
   m_current_flowing = !m_current_flowing;
   m_bulb->electrified(m_current_flowing);
-  cout << "lamp turned " << (m_bulb->is_lit() ? "on" : "off") << endl;
+  m_log.log(m_bulb->is_lit() ? "lamp turned on" : "lamp turned off");
 }
 
 
@@ -129,15 +127,16 @@ LampWithUniqueBulb::lampcount (bool incr)
 //////////////////////////////////////////////////////////////////////////////////
 
 GaudyLamp::GaudyLamp ( )
-  : m_bulb(*DepInject::Factory<IBulb, GaudyTag>::get())
+  : m_bulb(*DepInject::get<IBulb, GaudyTag>()),
+    m_log(*DepInject::get<ILogger>())
 {
-  cout << "gaudy lamp #" << lampcount(true) << " created\n";
+  m_log.log("gaudy lamp #" + std::to_string(lampcount(true)) + " created");
 }
 
 
 GaudyLamp::~GaudyLamp ( )
 {
-  cout << "gaudy lamp #" << lampcount() << " destroyed\n";
+  m_log.log("gaudy lamp #" + std::to_string(lampcount()) + " destroyed");
 }
 
 
@@ -146,7 +145,7 @@ GaudyLamp::toggle_switch ( )
 {
   m_current_flowing = !m_current_flowing;
   m_bulb.electrified(m_current_flowing);
-  cout << "gaudy lamp turned " << (m_bulb.is_lit() ? "on" : "off") << endl;
+  m_log.log(m_bulb.is_lit() ? "gaudy lamp turned on" : "gaudy lamp turned off");
 }
 
 
@@ -166,3 +165,25 @@ GaudyLamp::lampcount (bool incr)
   else
     return count.load();
 }
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//
+//  class LazyLamp implementation.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+void
+LazyLamp::toggle_switch ( )
+{
+  m_current_flowing = !m_current_flowing;
+  m_bulb->electrified(m_current_flowing);
+  m_log->log(m_bulb->is_lit() ? "lazy lamp turned on" : "lazy lamp turned off");
+}
+
+
+bool
+LazyLamp::is_lit ( ) const
+{
+  return m_bulb->is_lit();
+}
@@ -24,7 +24,8 @@
 #define NOON_DI_LAMPS_H
 
 #include "di_bulb_api.h"
-#include <memory>
+#include "di_logger_api.h"
+#include "depinject_fwd.h"
 
 //-------------------------------------------------------------------------
 // Note: These lamp classes provide the same "concept" API, however they
@@ -48,8 +49,9 @@ public:
 private:
   static unsigned lampcount(bool incr = false);
 
-  IBulb& m_bulb;
-  bool   m_current_flowing {false};
+  IBulb&   m_bulb;
+  ILogger& m_log;
+  bool     m_current_flowing {false};
 };
 
 
@@ -70,8 +72,9 @@ public:
 private:
   static unsigned lampcount(bool incr = false);
 
-  std::unique_ptr<IBulb> m_bulb;
-  bool                   m_current_flowing {false};
+  DepInject::UniquePtr<IBulb> m_bulb;
+  ILogger&                    m_log;
+  bool                        m_current_flowing {false};
 };
 
 
@@ -92,8 +95,26 @@ public:
 private:
   static unsigned lampcount(bool incr = false);
 
-  IBulb& m_bulb;
-  bool   m_current_flowing {false};
+  IBulb&   m_bulb;
+  ILogger& m_log;
+  bool     m_current_flowing {false};
+};
+
+
+//
+//  LazyLamp class: A class using a shared IBulb object instance, and its logger, only
+//  once first switched on (or asked whether it is lit).  Constructing one builds nothing.
+//
+class LazyLamp {
+public:
+  void toggle_switch();
+
+  bool is_lit() const;
+
+private:
+  DepInject::Lazy<IBulb>   m_bulb;
+  DepInject::Lazy<ILogger> m_log;
+  bool                     m_current_flowing {false};
 };
 
 #endif // NOON_DI_LAMPS_H
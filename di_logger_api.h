@@ -0,0 +1,65 @@
+// di_logger_api.h -- DepInject test driver header declaring ILogger interface
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#ifndef NOON_DI_LOGGER_API_H
+#define NOON_DI_LOGGER_API_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+//---------------------------------------------------------------------
+// Note: The lamp and bulb classes log through an ILogger retrieved from
+//       DepInject::Factory<ILogger>, never writing to std::cout
+//       themselves.  Logger classes are implemented in di_loggers.cc.
+//---------------------------------------------------------------------
+
+//
+// ILogger class: An interface class describing all loggers.
+//
+class ILogger {
+public:
+
+  // Allow deletion through an interface pointer.
+  virtual ~ILogger();
+
+  // Forbid copying (slicing) via an interface pointer.
+  ILogger(ILogger const&) = delete;
+  ILogger& operator=(ILogger const&) = delete;
+
+  // Non-virtual public interface.  Log one line, given without its newline.
+  void log(char const* line) { do_log(line, std::strlen(line)); }
+
+  void log(std::string const& line) { do_log(line.data(), line.size()); }
+
+protected:
+  // Forbid instantiation of a bare interface class object.  (Constexpr, so that a
+  // logger may be constant-initialized, and used during dynamic initialization.)
+  constexpr ILogger() { }
+
+private:
+  // Virtual hook for derived class implementations.
+  virtual void do_log(char const* text, std::size_t length) = 0;
+};
+
+#endif // NOON_DI_LOGGER_API_H
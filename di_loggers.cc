@@ -0,0 +1,313 @@
+// di_loggers.cc -- DepInject test driver logger classes implementation
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+//
+
+#include "di_loggers.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//
+//  (abstract) class ILogger implementation.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+// Allow deletion through an interface pointer.
+ILogger::~ILogger ( )
+{ }
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//
+//  (concrete) class StreamLogger implementation.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+StreamLogger::StreamLogger (std::ostream& out)
+  : m_out(out)
+{ }
+
+
+void
+StreamLogger::do_log (char const* text, std::size_t length)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_out.write(text, static_cast<std::streamsize>(length));
+  m_out.put('\n');
+  m_out.flush();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////
+//
+//  (concrete) class AsyncLogger implementation.
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+//
+//  AsyncLogger::Ring class: a single-producer, single-consumer queue of bytes.  The
+//  logging thread owns 'head', the background thread 'tail'.  Each line is queued
+//  as one or more fragments, each a two-byte header (its length, with the top bit
+//  marking a line's last fragment) followed by its text, padded to an even size.
+//  A fragment never wraps around the end of the ring; a 'wrap' header in its place
+//  sends the reader back to the start.
+//
+class AsyncLogger::Ring {
+public:
+  // Producer: append one line.
+  void push (char const* text, std::size_t length, AsyncLogger& logger)
+  {
+    do {
+      std::size_t n = length;
+      if (n > max_fragment)
+        n = max_fragment;
+      std::uint16_t header = static_cast<std::uint16_t>(n | (n == length ? last_bit : 0));
+      std::size_t   need   = (header_size + n + 1) & ~std::size_t(1);
+      std::size_t   h      = head.load(std::memory_order_relaxed);
+      std::size_t   at     = h % ring_bytes;
+      std::size_t   skip   = (ring_bytes - at < need) ? ring_bytes - at : 0;
+      reserve(h, skip + need, logger);
+      if (skip) {
+        std::memcpy(data + at, &wrap, header_size);
+        h += skip;
+        at = 0;
+      }
+      std::memcpy(data + at, &header, header_size);
+      std::memcpy(data + at + header_size, text, n);
+      head.store(h + need, std::memory_order_release);
+      text   += n;
+      length -= n;
+
+      // Nudge the background thread as the ring passes half full.
+      if (h - seen_tail < ring_bytes / 2 && h + need - seen_tail >= ring_bytes / 2)
+        logger.nudge(false);
+    } while (length);
+  }
+
+  // Consumer: append everything queued to 'batch'.
+  void pop (std::string& batch)
+  {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t h = head.load(std::memory_order_acquire);
+    while (t != h) {
+      std::size_t   at = t % ring_bytes;
+      std::uint16_t header;
+      std::memcpy(&header, data + at, header_size);
+      if (header == wrap) {
+        t += ring_bytes - at;
+        continue;
+      }
+      std::size_t n = header & ~last_bit;
+      batch.append(data + at + header_size, n);
+      if (header & last_bit)
+        batch.push_back('\n');
+      t += (header_size + n + 1) & ~std::size_t(1);
+    }
+    tail.store(t, std::memory_order_release);
+  }
+
+  std::atomic<bool> retired {false};    // its thread has exited
+  std::atomic<bool> closed  {false};    // its logger is destroyed
+
+private:
+  static constexpr std::size_t   header_size = 2;
+  static constexpr std::uint16_t last_bit    = 0x8000;
+  static constexpr std::uint16_t wrap        = 0xffff;
+
+  static_assert(max_fragment < last_bit && header_size + max_fragment <= ring_bytes / 4,
+                "AsyncLogger: fragments must fit the ring comfortably");
+  static_assert(ring_bytes % 2 == 0, "AsyncLogger: fragments are padded to even sizes");
+
+  // Wait until bytes [h, h + n) are free.
+  void reserve (std::size_t h, std::size_t n, AsyncLogger& logger)
+  {
+    if (ring_bytes - (h - seen_tail) >= n)
+      return;
+    seen_tail = tail.load(std::memory_order_acquire);
+    while (ring_bytes - (h - seen_tail) < n) {
+      logger.nudge(true);
+      std::this_thread::yield();
+      seen_tail = tail.load(std::memory_order_acquire);
+    }
+  }
+
+  // Producer and consumer indexes on cache lines of their own.  The producer keeps
+  // the last tail it read, so that it need not read 'tail' on every push.
+  char                     pad0[64];
+  std::atomic<std::size_t> head      {0};
+  std::size_t              seen_tail {0};
+  char                     pad1[64];
+  std::atomic<std::size_t> tail      {0};
+  char                     pad2[64];
+  char                     data[ring_bytes];
+};
+
+
+//
+//  AsyncLogger::ThreadRings struct: the rings of the calling thread, one per logger
+//  it has used, retired when the thread exits.
+//
+struct AsyncLogger::ThreadRings {
+  ~ThreadRings ( )
+  {
+    for (auto& entry : entries)
+      entry.second->retired.store(true, std::memory_order_release);
+  }
+
+  std::vector<std::pair<std::uint64_t, std::shared_ptr<Ring>>> entries;
+};
+
+
+namespace {
+
+  std::uint64_t
+  next_logger_id ( )
+  {
+    static std::atomic<std::uint64_t> next {0};
+    return ++next;
+  }
+
+} // namespace
+
+
+AsyncLogger::AsyncLogger (std::ostream& out)
+  : m_out(out), m_id(next_logger_id())
+{
+  m_thread = std::thread([this]() { drain(); });
+}
+
+
+AsyncLogger::~AsyncLogger ( )
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+  for (auto& ring : m_rings)
+    ring->closed.store(true, std::memory_order_release);
+}
+
+
+void
+AsyncLogger::flush ( )
+{
+  // Wait for a complete pass over the rings begun after this call.
+  std::unique_lock<std::mutex> lock(m_mutex);
+  std::uint64_t target = m_passes + 2;
+  if (m_wanted_passes < target)
+    m_wanted_passes = target;
+  m_wake.notify_one();
+  m_drained.wait(lock, [this, target]() { return m_passes >= target; });
+}
+
+
+// Wake the background thread early.  Unless 'reliably', the wakeup may be missed,
+// leaving the background thread to find the lines on its next regular pass.
+void
+AsyncLogger::nudge (bool reliably)
+{
+  if (reliably) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_nudged.store(true, std::memory_order_relaxed);
+  }
+  else
+    m_nudged.store(true, std::memory_order_relaxed);
+  m_wake.notify_one();
+}
+
+
+void
+AsyncLogger::do_log (char const* text, std::size_t length)
+{
+  my_ring().push(text, length, *this);
+}
+
+
+AsyncLogger::Ring&
+AsyncLogger::my_ring ( )
+{
+  static thread_local ThreadRings mine;
+  for (auto& entry : mine.entries) {
+    if (entry.first == m_id)
+      return *entry.second;
+  }
+
+  // First line from this thread: forget rings of destroyed loggers, and enlist a
+  // new one.
+  for (auto i = mine.entries.begin(); i != mine.entries.end(); ) {
+    if (i->second->closed.load(std::memory_order_acquire))
+      i = mine.entries.erase(i);
+    else
+      ++i;
+  }
+  auto ring = std::make_shared<Ring>();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rings.push_back(ring);
+  }
+  mine.entries.emplace_back(m_id, ring);
+  return *ring;
+}
+
+
+void
+AsyncLogger::drain ( )
+{
+  std::string                  batch;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    bool stopping = m_stopping;
+    m_nudged.store(false, std::memory_order_relaxed);
+
+    // Collect everything queued, dropping the rings of exited threads once empty.
+    for (auto i = m_rings.begin(); i != m_rings.end(); ) {
+      bool retired = (*i)->retired.load(std::memory_order_acquire);
+      (*i)->pop(batch);
+      if (retired)
+        i = m_rings.erase(i);
+      else
+        ++i;
+    }
+
+    if (!batch.empty()) {
+      lock.unlock();
+      m_out.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+      m_out.flush();
+      batch.clear();
+      lock.lock();
+    }
+    ++m_passes;
+    m_drained.notify_all();
+
+    if (stopping)
+      return;
+    m_wake.wait_for(lock, std::chrono::milliseconds(10),
+                    [this]() {
+                      return m_stopping || m_passes < m_wanted_passes ||
+                             m_nudged.load(std::memory_order_relaxed);
+                    });
+  }
+}
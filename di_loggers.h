@@ -0,0 +1,109 @@
+// di_loggers.h -- DepInject test driver header declaring logger classes
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#ifndef NOON_DI_LOGGERS_H
+#define NOON_DI_LOGGERS_H
+
+#include "di_logger_api.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+//
+//  NullLogger class: discards everything.  It is constant-initialized when static,
+//  so that compile-time bound objects may log during dynamic initialization.
+//
+class NullLogger final : public ILogger {
+public:
+  constexpr NullLogger() { }
+
+private:
+  virtual void do_log(char const*, std::size_t) override { }
+};
+
+
+//
+//  StreamLogger class: writes and flushes each line on the calling thread, under
+//  a lock.
+//
+class StreamLogger final : public ILogger {
+public:
+  explicit StreamLogger(std::ostream& out);
+
+private:
+  virtual void do_log(char const* text, std::size_t length) override;
+
+  std::ostream& m_out;
+  std::mutex    m_mutex;
+};
+
+
+//
+//  AsyncLogger class: each logging thread appends its lines to a ring buffer of its
+//  own, without locks; a background thread drains all the rings and writes what it
+//  finds to the stream in batches, flushing once per batch.  Lines from one thread
+//  are written in order; lines from different threads are interleaved by batch.
+//  A thread whose ring is full waits for the background thread to catch up.
+//
+class AsyncLogger final : public ILogger {
+public:
+  // Bytes in each thread's ring; lines longer than 'max_fragment' are queued in
+  // pieces.
+  static constexpr std::size_t ring_bytes   = 65536;
+  static constexpr std::size_t max_fragment = 1024;
+
+  explicit AsyncLogger(std::ostream& out);
+  ~AsyncLogger();
+
+  // Wait until every line logged before the call has been written.
+  void flush();
+
+private:
+  class Ring;
+  struct ThreadRings;
+
+  virtual void do_log(char const* text, std::size_t length) override;
+
+  Ring& my_ring();
+  void nudge(bool reliably);
+  void drain();
+
+  std::ostream&                      m_out;
+  std::uint64_t                      m_id;
+  std::mutex                         m_mutex;     // guards the members below
+  std::condition_variable            m_wake;
+  std::condition_variable            m_drained;
+  std::vector<std::shared_ptr<Ring>> m_rings;
+  std::uint64_t                      m_passes        {0};
+  std::uint64_t                      m_wanted_passes {0};    // by flush()
+  bool                               m_stopping      {false};
+  std::atomic<bool>                  m_nudged        {false};
+  std::thread                        m_thread;    // last: started by the constructor
+};
+
+#endif // NOON_DI_LOGGERS_H
@@ -23,13 +23,26 @@
 
 #include "di_bulbs.h"
 #include "di_lamps.h"
+#include "di_loggers.h"
 #include "depinject.h"
+#include "di_factories.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 using std::cout;
 using std::endl;
@@ -43,6 +56,44 @@ TYPE_TO_STRING(GaudyLamp);
 // A tag never used by any class to retrieve a dependency.
 struct WrongTag {};
 
+// A tag bound to a concrete class at compile time.
+struct StaticTag {};
+
+// A bulb for static binding.  (Unlike Bulb, it does not log on construction, and so
+// may be constructed before main() declares the logger.)
+class StaticBulb final : public IBulb {
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  bool m_is_lit {false};
+};
+
+DEPINJECT_BIND(IBulb, StaticTag, StaticBulb)
+
+
+// A logger keeping what the lamps and bulbs log, for the tests to inspect.
+class RecordingLogger final : public ILogger {
+public:
+  std::vector<std::string> lines ( ) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lines;
+  }
+
+  static RecordingLogger& current ( ) {
+    return static_cast<RecordingLogger&>(*DepInject::Factory<ILogger>::get());
+  }
+
+private:
+  void do_log (char const* text, std::size_t length) override {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lines.emplace_back(text, length);
+  }
+
+  mutable std::mutex       m_mutex;
+  std::vector<std::string> m_lines;
+};
+
 
 // reset_all_factories:
 //   Clear entries from all (singleton) Factory<>'s to establish a known
@@ -51,10 +102,10 @@ struct WrongTag {};
 void
 reset_all_factories ( )
 {
-    DepInject::Factory<IBulb           >::testing_reset();
-    DepInject::Factory<IBulb, UniqueTag>::testing_reset();
-    DepInject::Factory<IBulb, GaudyTag >::testing_reset();
-    DepInject::Factory<IBulb, WrongTag >::testing_reset();
+    DepInject::testing_reset_all();
+
+    // The lamps and bulbs all log.
+    DepInject::Factory<ILogger>::declare([]() -> ILogger* {return new RecordingLogger;});
 }
 
 
@@ -158,13 +209,11 @@ TEST_SUITE("Test exception generation")
     reset_all_factories();
 
     GIVEN("A class with a non-unique dependency") {
-      using Lamp_T = Lamp;
-
       WHEN("The dependency allocator function is registered as \"unique\"") {
         DepInject::Factory<IBulb>::declare_unique([]() -> IBulb* {return new Bulb;});
 
         THEN("The attempted allocation should throw") {
-          CHECK_THROWS_WITH(Lamp_T lamp,
+          CHECK_THROWS_WITH(Lamp lamp,
                             "DepInject: get: request for "
                             "non-unique instance doesn't match declaration");
         }
@@ -176,13 +225,11 @@ TEST_SUITE("Test exception generation")
     reset_all_factories();
 
     GIVEN("A class with a unique dependency") {
-      using Lamp_T = LampWithUniqueBulb;
-
       WHEN("The dependency allocator function is NOT registered as \"unique\"") {
         DepInject::Factory<IBulb, UniqueTag>::declare([]() -> IBulb* {return new Bulb;});
 
         THEN("The attempted allocation should throw") {
-          CHECK_THROWS_WITH(Lamp_T lamp,
+          CHECK_THROWS_WITH(LampWithUniqueBulb lamp,
                             "DepInject: get: request for "
                             "unique instance doesn't match declaration");
         }
@@ -192,6 +239,86 @@ TEST_SUITE("Test exception generation")
 }
 
 
+TEST_CASE("Test non-throwing retrieval")
+{
+  struct TryTag {};
+  using TryFactory = DepInject::Factory<IBulb, TryTag>;
+
+  static_assert(noexcept(TryFactory::try_get()), "try_get() must not throw");
+  static_assert(noexcept(TryFactory::try_get_unique()), "try_get_unique() must not throw");
+
+  reset_all_factories();
+
+  SUBCASE("An undeclared type+tag is reported") {
+    DepInject::Result<IBulb> result = TryFactory::try_get();
+    CHECK_FALSE(result);
+    CHECK(result.get() == nullptr);
+    CHECK(result.error() == DepInject::Error::not_declared);
+    CHECK(std::string(result.message()) == "DepInject: get: object type+tag not declared");
+  }
+
+  SUBCASE("A failing builder is reported") {
+    TryFactory::declare([]() -> IBulb* {return nullptr;});
+    CHECK(TryFactory::try_get().error() == DepInject::Error::allocation_failed);
+  }
+
+  SUBCASE("Mismatched lifetimes are reported") {
+    TryFactory::declare([]() -> IBulb* {return new Bulb;});
+    CHECK(TryFactory::try_get_unique().error() == DepInject::Error::unique_mismatch);
+    reset_all_factories();
+    TryFactory::declare_unique([]() -> IBulb* {return new Bulb;});
+    CHECK(TryFactory::try_get().error() == DepInject::Error::shared_mismatch);
+  }
+
+  SUBCASE("A shared instance is the one get() returns") {
+    TryFactory::declare([]() -> IBulb* {return new Bulb;});
+    DepInject::Result<IBulb> result = TryFactory::try_get();
+    REQUIRE(result);
+    CHECK(result.error() == DepInject::Error::none);
+    CHECK(result.get() == TryFactory::get());
+    result->electrified(true);
+    CHECK((*result).is_lit());
+  }
+
+  SUBCASE("A unique instance belongs to the caller") {
+    TryFactory::declare_unique([]() -> IBulb* {return new Bulb;});
+    DepInject::Result<IBulb> first = TryFactory::try_get_unique();
+    DepInject::Result<IBulb> second = TryFactory::try_get_unique();
+    REQUIRE(first);
+    REQUIRE(second);
+    CHECK(first.get() != second.get());
+    delete first.get();
+    delete second.get();
+  }
+
+  SUBCASE("A dependency cycle is reported") {
+    DepInject::Error inner = DepInject::Error::none;
+    TryFactory::declare([&inner]() -> IBulb* {
+      inner = TryFactory::try_get().error();
+      return new Bulb;
+    });
+    CHECK(TryFactory::try_get());
+    CHECK(inner == DepInject::Error::dependency_cycle);
+  }
+
+  SUBCASE("A scoped instance outside any Scope is reported") {
+    TryFactory::declare_scoped<Bulb>();
+    CHECK(TryFactory::try_get().error() == DepInject::Error::outside_scope);
+    DepInject::Scope scope;
+    CHECK(TryFactory::try_get());
+  }
+
+#if DEPINJECT_EXCEPTIONS
+  SUBCASE("A throwing builder is reported") {
+    TryFactory::declare([]() -> IBulb* {throw std::runtime_error("no bulbs left");});
+    CHECK(TryFactory::try_get().error() == DepInject::Error::build_threw);
+  }
+#endif
+
+  reset_all_factories();
+}
+
+
 template <typename Lamp_T>
 void exercise_lamp_wiring ( )
 {
@@ -224,4 +351,1625 @@ TEST_CASE("Test basic factory functionality")
   exercise_lamp_wiring<Lamp>();
   exercise_lamp_wiring<LampWithUniqueBulb>();
   exercise_lamp_wiring<GaudyLamp>();
+  exercise_lamp_wiring<LazyLamp>();
+}
+
+
+// Count of Bulb constructions made by counting_bulb_builder().
+static std::atomic<int> bulbs_built {0};
+
+IBulb*
+counting_bulb_builder ( )
+{
+  bulbs_built.fetch_add(1);
+  std::this_thread::yield();   // widen the race window
+  return new Bulb;
+}
+
+
+TEST_CASE("Test concurrent retrieval of a shared instance")
+{
+  reset_all_factories();
+  bulbs_built = 0;
+
+  DepInject::Factory<IBulb>::declare(counting_bulb_builder);
+
+  // Several threads race on the first get(); all must see the one common instance.
+  const unsigned nthreads = 8;
+  std::vector<IBulb*>      seen(nthreads, nullptr);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < nthreads; ++t)
+    threads.emplace_back([&seen, t]() { seen[t] = DepInject::Factory<IBulb>::get(); });
+  for (auto& th : threads)
+    th.join();
+
+  CHECK(bulbs_built == 1);
+  for (IBulb* bulb : seen)
+    CHECK(bulb == seen[0]);
+  CHECK(DepInject::Factory<IBulb>::get() == seen[0]);
+}
+
+
+TEST_CASE("Test lazy dependencies")
+{
+  struct LazyTag {};
+  using LazyFactory = DepInject::Factory<IBulb, LazyTag>;
+
+  reset_all_factories();
+  bulbs_built = 0;
+
+  SUBCASE("Constructing a lazy lamp builds nothing") {
+    LazyLamp lamp;                            // nothing is even declared yet
+    DepInject::Factory<IBulb>::declare(counting_bulb_builder);
+    CHECK(bulbs_built == 0);
+    lamp.toggle_switch();
+    CHECK(bulbs_built == 1);
+    CHECK(lamp.is_lit());
+    CHECK(DepInject::Factory<IBulb>::get()->is_lit());
+  }
+
+  SUBCASE("A handle resolves once, to the shared instance") {
+    LazyFactory::declare(counting_bulb_builder);
+    DepInject::Lazy<IBulb, LazyTag> lazy;
+    CHECK_FALSE(lazy.resolved());
+
+    const unsigned nthreads = 8;
+    std::vector<IBulb*>      seen(nthreads, nullptr);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; ++t)
+      threads.emplace_back([&seen, &lazy, t]() { seen[t] = lazy.get(); });
+    for (auto& th : threads)
+      th.join();
+
+    CHECK(lazy.resolved());
+    CHECK(bulbs_built == 1);
+    for (IBulb* bulb : seen)
+      CHECK(bulb == LazyFactory::get());
+
+    DepInject::Lazy<IBulb, LazyTag> copy(lazy);
+    CHECK(copy.resolved());
+    CHECK(&*copy == seen[0]);
+  }
+
+  SUBCASE("A failed retrieval leaves the handle unresolved") {
+    DepInject::Lazy<IBulb, LazyTag> lazy;
+    CHECK_THROWS_WITH(lazy.get(), "DepInject: get: object type+tag not declared");
+    CHECK_FALSE(lazy.resolved());
+  }
+
+  reset_all_factories();
+}
+
+
+TEST_CASE("Test keyed instances")
+{
+  struct KeyedTag {};
+  using KeyedFactory = DepInject::Factory<IBulb, KeyedTag>;
+
+  reset_all_factories();
+  bulbs_built = 0;
+
+  auto keyed_builder = [](int const&) -> IBulb* {
+    bulbs_built.fetch_add(1);
+    return new Bulb;
+  };
+
+  SUBCASE("Each key has its own shared instance") {
+    KeyedFactory::declare_keyed<int>(keyed_builder);
+    IBulb* one = KeyedFactory::get(1);
+    CHECK(KeyedFactory::get(1) == one);
+    CHECK(KeyedFactory::get(2) != one);
+    CHECK(bulbs_built == 2);
+    CHECK(KeyedFactory::keyed_count<int>() == 2);
+  }
+
+  SUBCASE("Keys may be strings, and the builder sees them") {
+    KeyedFactory::declare_keyed<std::string>([](std::string const& key) -> IBulb* {
+      return key == "gaudy" ? static_cast<IBulb*>(new GaudyBulb) : new Bulb;
+    });
+    CHECK(dynamic_cast<GaudyBulb*>(KeyedFactory::get(std::string("gaudy"))) != nullptr);
+    CHECK(dynamic_cast<GaudyBulb*>(KeyedFactory::get(std::string("plain"))) == nullptr);
+  }
+
+  SUBCASE("Racing threads find one instance per key") {
+    KeyedFactory::declare_keyed<int>(keyed_builder);
+    const unsigned nthreads = 8;
+    const int      nkeys    = 1000;
+    std::vector<std::vector<IBulb*>> seen(nthreads, std::vector<IBulb*>(nkeys));
+    std::vector<std::thread>         threads;
+    for (unsigned t = 0; t < nthreads; ++t) {
+      threads.emplace_back([&seen, t]() {
+        for (int k = 0; k < nkeys; ++k)
+          seen[t][k] = KeyedFactory::get(k);
+      });
+    }
+    for (auto& th : threads)
+      th.join();
+    CHECK(bulbs_built == nkeys);
+    CHECK(KeyedFactory::keyed_count<int>() == std::size_t(nkeys));
+    for (unsigned t = 1; t < nthreads; ++t)
+      CHECK(seen[t] == seen[0]);
+  }
+
+  SUBCASE("A limit on keys is enforced") {
+    KeyedFactory::declare_keyed<int>(keyed_builder, 2);
+    KeyedFactory::get(1);
+    KeyedFactory::get(2);
+    CHECK_THROWS_WITH(KeyedFactory::get(3),
+                      "DepInject: get: keyed declaration's limit of keys reached");
+    CHECK(KeyedFactory::get(1) != nullptr);
+    CHECK(KeyedFactory::keyed_count<int>() == 2);
+  }
+
+  SUBCASE("Failures are reported") {
+    CHECK_THROWS_WITH(KeyedFactory::get(1), "DepInject: get: object type+tag not declared");
+    KeyedFactory::declare_keyed<int>([](int const&) -> IBulb* {return nullptr;}, 1);
+    CHECK_THROWS_WITH(KeyedFactory::get(1), "DepInject: get: object allocation failed");
+    CHECK(KeyedFactory::keyed_count<int>() == 0);       // the failure held no key
+  }
+
+  SUBCASE("shutdown() destroys the instances, and refuses their keys thereafter") {
+    KeyedFactory::declare_keyed<int>([](int const&) -> IBulb* {return new StaticBulb;});
+    KeyedFactory::get(1);
+    KeyedFactory::get(2);
+    CHECK(DepInject::shutdown() >= 1);
+    CHECK(KeyedFactory::keyed_count<int>() == 0);
+    CHECK_THROWS_WITH(KeyedFactory::get(1),
+                      "DepInject: get: shared instance requested after shutdown");
+  }
+
+#if DEPINJECT_EXCEPTIONS
+  SUBCASE("get() racing shutdown() either finds its key or fails cleanly") {
+    // StaticBulb, as shutdown() takes the logger that Bulb logs to.
+    KeyedFactory::declare_keyed<int>([](int const&) -> IBulb* {return new StaticBulb;});
+    const unsigned           nthreads = 4;
+    std::atomic<unsigned>    running {0};
+    std::atomic<unsigned>    refused {0};
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; ++t) {
+      threads.emplace_back([&running, &refused]() {
+        running.fetch_add(1);
+        try {
+          for (int k = 0; ; k = (k + 1) % 256)
+            KeyedFactory::get(k);
+        }
+        catch (std::exception const& e) {
+          if (std::string(e.what()) == DepInject::describe(DepInject::Error::after_shutdown))
+            refused.fetch_add(1);
+        }
+      });
+    }
+    while (running.load() != nthreads)
+      std::this_thread::yield();
+    DepInject::shutdown();
+    for (auto& th : threads)
+      th.join();
+    CHECK(refused == nthreads);
+    CHECK(KeyedFactory::keyed_count<int>() == 0);
+  }
+#endif
+
+  reset_all_factories();
+}
+
+
+// Counts of pooled Bulb constructions and recycling resets.
+static std::atomic<int> bulbs_reset {0};
+
+void
+reset_bulb (IBulb& bulb)
+{
+  bulbs_reset.fetch_add(1);
+  bulb.electrified(false);
+}
+
+
+TEST_CASE("Test pooled unique instances")
+{
+  reset_all_factories();
+  bulbs_built = 0;
+  bulbs_reset = 0;
+
+  DepInject::Factory<IBulb, UniqueTag>::declare_pooled(counting_bulb_builder, reset_bulb);
+
+  SUBCASE("A released instance is reset and handed out again") {
+    IBulb* first = nullptr;
+    {
+      auto bulb = DepInject::Factory<IBulb, UniqueTag>::get_unique_ptr();
+      first = bulb.get();
+      bulb->electrified(true);
+    }
+    CHECK(bulbs_reset == 1);
+
+    auto again = DepInject::Factory<IBulb, UniqueTag>::get_unique_ptr();
+    CHECK(again.get() == first);
+    CHECK(!again->is_lit());
+    CHECK(bulbs_built == 1);
+  }
+
+  SUBCASE("Instances in use are never shared") {
+    auto a = DepInject::Factory<IBulb, UniqueTag>::get_unique_ptr();
+    auto b = DepInject::Factory<IBulb, UniqueTag>::get_unique_ptr();
+    CHECK(a.get() != b.get());
+    CHECK(bulbs_built == 2);
+  }
+
+  SUBCASE("Lamps with unique bulbs recycle their bulbs") {
+    exercise_lamp_wiring<LampWithUniqueBulb>();
+    exercise_lamp_wiring<LampWithUniqueBulb>();
+    CHECK(bulbs_built == 1);
+  }
+
+  SUBCASE("Instances released after a reset are not recycled") {
+    auto bulb = DepInject::Factory<IBulb, UniqueTag>::get_unique_ptr();
+    reset_all_factories();
+    bulb.reset();
+    CHECK(bulbs_reset == 0);
+  }
+
+#if DEPINJECT_EXCEPTIONS
+  SUBCASE("A pooled declaration is not a shared one") {
+    using PooledFactory = DepInject::Factory<IBulb, UniqueTag>;
+    CHECK_THROWS_WITH(PooledFactory::get(),
+                      "DepInject: get: request for "
+                      "non-unique instance doesn't match declaration");
+  }
+#endif
+}
+
+
+TEST_CASE("Test compile-time bindings")
+{
+  using BoundFactory = DepInject::Factory<IBulb, StaticTag>;
+
+  static_assert(DepInject::Binding<IBulb, StaticTag>::bound, "StaticTag should be bound");
+  static_assert(!DepInject::Binding<IBulb>::bound, "the default tag should not be bound");
+  static_assert(std::is_same<decltype(DepInject::bound<IBulb, StaticTag>()),
+                             StaticBulb&>::value,
+                "bound<>() should return the concrete type");
+
+  // No declaration is needed, and every get() returns the same static object.
+  StaticBulb& bulb = DepInject::bound<IBulb, StaticTag>();
+  CHECK(BoundFactory::get() == &bulb);
+  CHECK(BoundFactory::get() == BoundFactory::get());
+
+  bulb.electrified(true);
+  CHECK(BoundFactory::get()->is_lit());
+  bulb.electrified(false);
+}
+
+#ifdef DI_TEST_BOUND_DECLARATION
+// Compiled only by "make test", which expects the static_assert refusing any
+// declaration of a bound type+tag, here a thread-local one.
+void declare_bound_thread_local ( ) {
+  DepInject::Factory<IBulb, StaticTag>::declare_thread_local([]() -> IBulb* {return new Bulb;});
+}
+#endif
+
+
+TEST_CASE("Test explicitly instantiated factories")
+{
+  // di_factories.h declares these type+tags' retrievals extern; so, taken by address,
+  // they are di_factories.cc's instantiations, as code seeing only depinject_fwd.h
+  // (like the lamps) calls them.
+  IBulb*                      (*get_bulb)()       = &DepInject::get<IBulb>;
+  IBulb*                      (*get_gaudy)()      = &DepInject::get<IBulb, GaudyTag>;
+  ILogger*                    (*get_logger)()     = &DepInject::get<ILogger>;
+  IBulb*                      (*get_unique)()     = &DepInject::get_unique<IBulb, UniqueTag>;
+  DepInject::UniquePtr<IBulb> (*get_unique_ptr)() = &DepInject::get_unique_ptr<IBulb, UniqueTag>;
+
+  using GaudyFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  bulbs_built = 0;
+  DepInject::Factory<IBulb>::declare([]() -> IBulb* {return new Bulb;});
+  GaudyFactory::declare([]() -> IBulb* {return new GaudyBulb;});
+  DepInject::Factory<IBulb, UniqueTag>::declare_unique(counting_bulb_builder);
+
+  SUBCASE("They share the declarations and instances of Factory<>") {
+    CHECK(get_bulb() == DepInject::Factory<IBulb>::get());
+    CHECK(get_gaudy() == GaudyFactory::get());
+    CHECK(get_gaudy() != get_bulb());
+    CHECK(dynamic_cast<GaudyBulb*>(get_gaudy()) != nullptr);
+    CHECK(get_logger() == &RecordingLogger::current());
+  }
+
+  SUBCASE("Unique retrievals build a new instance each") {
+    std::unique_ptr<IBulb>      first(get_unique());
+    DepInject::UniquePtr<IBulb> second = get_unique_ptr();
+    CHECK(first.get() != second.get());
+    CHECK(bulbs_built == 2);
+  }
+
+  SUBCASE("A lamp retrieves its bulb through them") {
+    GaudyLamp lamp;
+    lamp.toggle_switch();
+    CHECK(get_gaudy()->is_lit());
+    CHECK(GaudyFactory::get()->is_lit());
+  }
+
+  SUBCASE("Failures propagate from them as from Factory<>") {
+    GaudyFactory::testing_reset();
+    CHECK_THROWS_WITH(get_gaudy(), "DepInject: get: object type+tag not declared");
+  }
+
+  reset_all_factories();
+}
+
+
+TEST_CASE("Test prewarming shared instances")
+{
+  reset_all_factories();
+  bulbs_built = 0;
+
+  DepInject::Factory<IBulb          >::declare(counting_bulb_builder);
+  DepInject::Factory<IBulb, GaudyTag>::declare(counting_bulb_builder);
+  DepInject::Factory<IBulb, UniqueTag>::declare_unique(counting_bulb_builder);
+
+  // Bulbs log as they are built.
+  DepInject::Factory<IBulb          >::depends_on<ILogger>();
+  DepInject::Factory<IBulb, GaudyTag>::depends_on<ILogger>();
+
+  auto check_prewarmed = [](std::vector<DepInject::BuildTime> const& timings) {
+    // Only the two shared instances, and the shared logger, are built.
+    CHECK(timings.size() == 3);
+    CHECK(bulbs_built == 2);
+    auto gaudy = std::find_if(timings.begin(), timings.end(),
+                              [](DepInject::BuildTime const& t) { return t.tag == "GaudyTag"; });
+    REQUIRE(gaudy != timings.end());
+    CHECK(gaudy->dependency == "IBulb");
+    CHECK(gaudy->elapsed.count() >= 0);
+
+    // Later retrievals find the instances already built.
+    exercise_lamp_wiring<Lamp>();
+    exercise_lamp_wiring<GaudyLamp>();
+    CHECK(bulbs_built == 2);
+  };
+
+  SUBCASE("Prewarming on the calling thread") {
+    check_prewarmed(DepInject::prewarm());
+  }
+
+  SUBCASE("Prewarming on a pool of threads") {
+    check_prewarmed(DepInject::prewarm(4));
+  }
+
+  SUBCASE("Prewarming twice builds nothing more") {
+    DepInject::prewarm();
+    CHECK(DepInject::prewarm().empty());
+    CHECK(bulbs_built == 2);
+  }
+
+  SUBCASE("Instances already retrieved are not rebuilt") {
+    DepInject::Factory<IBulb>::get();
+    CHECK(DepInject::prewarm().size() == 1);
+    CHECK(bulbs_built == 2);
+  }
+
+  SUBCASE("A failing builder is reported") {
+    DepInject::Factory<IBulb, WrongTag>::declare([]() -> IBulb* {return nullptr;});
+    CHECK_THROWS_WITH(DepInject::prewarm(2), "DepInject: prewarm: object allocation failed");
+  }
+}
+
+
+// A gate holding gated_bulb_builder() until the test opens it.
+static std::mutex              gate_mutex;
+static std::condition_variable gate_opened;
+static bool                    gate_open {false};
+
+void
+set_gate (bool open)
+{
+  {
+    std::lock_guard<std::mutex> lock(gate_mutex);
+    gate_open = open;
+  }
+  gate_opened.notify_all();
+}
+
+IBulb*
+gated_bulb_builder ( )
+{
+  bulbs_built.fetch_add(1);
+  std::unique_lock<std::mutex> lock(gate_mutex);
+  gate_opened.wait(lock, []() { return gate_open; });
+  return new Bulb;
+}
+
+
+TEST_CASE("Test asynchronous building")
+{
+  struct AsyncTag {};
+  using AsyncFactory = DepInject::Factory<IBulb, AsyncTag>;
+
+  reset_all_factories();
+  bulbs_built = 0;
+  set_gate(false);
+
+  SUBCASE("A declaration starts building in the background") {
+    AsyncFactory::declare_async(gated_bulb_builder);
+    std::shared_future<IBulb*> future = AsyncFactory::get_async();
+    CHECK(future.wait_for(std::chrono::milliseconds(20)) == std::future_status::timeout);
+    set_gate(true);
+    CHECK(future.get() == AsyncFactory::get());
+    CHECK(bulbs_built == 1);
+  }
+
+  SUBCASE("get() waits for a background build under way") {
+    AsyncFactory::declare_async(gated_bulb_builder);
+    while (bulbs_built == 0)
+      std::this_thread::yield();            // the build has begun
+    std::thread opener([]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      set_gate(true);
+    });
+    IBulb* bulb = AsyncFactory::get();
+    opener.join();
+    CHECK(bulb == AsyncFactory::get_async().get());
+    CHECK(bulbs_built == 1);
+  }
+
+  SUBCASE("A plain declaration is built in the background on request") {
+    AsyncFactory::declare(counting_bulb_builder);
+    CHECK(AsyncFactory::get_async().get() == AsyncFactory::get());
+    CHECK(bulbs_built == 1);
+  }
+
+  SUBCASE("A failed build is reported through the future") {
+    AsyncFactory::declare_async([]() -> IBulb* {return nullptr;});
+#if DEPINJECT_EXCEPTIONS
+    CHECK_THROWS_WITH(AsyncFactory::get_async().get(), "DepInject: get: object allocation failed");
+#else
+    CHECK(AsyncFactory::get_async().get() == nullptr);
+#endif
+  }
+
+  SUBCASE("Only shared declarations are built in the background") {
+    AsyncFactory::declare_unique(counting_bulb_builder);
+    CHECK_THROWS_WITH(AsyncFactory::get_async(),
+                      "DepInject: get: request for non-unique instance doesn't match declaration");
+  }
+
+  set_gate(true);
+  reset_all_factories();
+}
+
+
+// The order in which the recording builders below ran.
+static std::mutex               build_order_mutex;
+static std::vector<std::string> build_order;
+
+template <typename Tag>
+IBulb*
+recording_bulb_builder ( )
+{
+  std::lock_guard<std::mutex> lock(build_order_mutex);
+  build_order.push_back(DepInject::Internals::type_name<Tag>());
+  return new Bulb;
+}
+
+
+bool
+built_before (std::string const& first, std::string const& second)
+{
+  auto f = std::find(build_order.begin(), build_order.end(), first);
+  auto s = std::find(build_order.begin(), build_order.end(), second);
+  return f != build_order.end() && s != build_order.end() && f < s;
+}
+
+
+TEST_CASE("Test dependency graphs")
+{
+  using DefaultFactory = DepInject::Factory<IBulb>;
+  using GaudyFactory   = DepInject::Factory<IBulb, GaudyTag>;
+  using WrongFactory   = DepInject::Factory<IBulb, WrongTag>;
+  using UniqueFactory  = DepInject::Factory<IBulb, UniqueTag>;
+
+  reset_all_factories();
+  build_order.clear();
+
+  SUBCASE("A cycle is refused when declared") {
+    DefaultFactory::depends_on<IBulb, GaudyTag>();
+    GaudyFactory::depends_on<IBulb, WrongTag>();
+    CHECK_THROWS_WITH(WrongFactory::depends_on<IBulb>(),
+                      "DepInject: depends_on: dependency cycle detected");
+    CHECK_THROWS_WITH((WrongFactory::depends_on<IBulb, WrongTag>()),
+                      "DepInject: depends_on: dependency cycle detected");
+  }
+
+  SUBCASE("A builder retrieving itself is refused") {
+    DefaultFactory::declare([]() -> IBulb* {return DefaultFactory::get();});
+    CHECK_THROWS_WITH(DefaultFactory::get(), "DepInject: get: dependency cycle detected");
+  }
+
+  SUBCASE("Prewarming builds dependencies first") {
+    // A diamond: default -> {gaudy, wrong} -> unique-tagged shared bulb.
+    DefaultFactory::declare(recording_bulb_builder<DepInject::DefaultTag>);
+    GaudyFactory  ::declare(recording_bulb_builder<GaudyTag>);
+    WrongFactory  ::declare(recording_bulb_builder<WrongTag>);
+    UniqueFactory ::declare(recording_bulb_builder<UniqueTag>);
+    DefaultFactory::depends_on<IBulb, GaudyTag>();
+    DefaultFactory::depends_on<IBulb, WrongTag>();
+    GaudyFactory  ::depends_on<IBulb, UniqueTag>();
+    WrongFactory  ::depends_on<IBulb, UniqueTag>();
+    UniqueFactory ::depends_on<ILogger>();        // bulbs log as they are built
+
+    unsigned nthreads = 1;
+    SUBCASE("on the calling thread") { nthreads = 1; }
+    SUBCASE("on a thread pool")      { nthreads = 4; }
+
+    CHECK(DepInject::prewarm(nthreads).size() == 5);     // and the logger
+    REQUIRE(build_order.size() == 4);
+    CHECK(built_before("UniqueTag", "GaudyTag"));
+    CHECK(built_before("UniqueTag", "WrongTag"));
+    CHECK(built_before("GaudyTag", "DepInject::DefaultTag"));
+    CHECK(built_before("WrongTag", "DepInject::DefaultTag"));
+  }
+
+  SUBCASE("Resetting a factory forgets its dependencies") {
+    DefaultFactory::depends_on<IBulb, GaudyTag>();
+    DefaultFactory::testing_reset();
+    CHECK_NOTHROW(GaudyFactory::depends_on<IBulb>());
+  }
+}
+
+
+// A bulb counting its live instances.
+class CountedBulb final : public IBulb {
+public:
+  CountedBulb ( ) { live.fetch_add(1); }
+  ~CountedBulb ( ) { live.fetch_sub(1); }
+
+  static std::atomic<int> live;
+
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  bool m_is_lit {false};
+};
+
+std::atomic<int> CountedBulb::live {0};
+
+
+TEST_CASE("Test thread-local instances")
+{
+  using ThreadFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  ThreadFactory::declare_thread_local([]() -> IBulb* {return new CountedBulb;});
+
+  SUBCASE("Each thread has its own instance") {
+    IBulb* mine = ThreadFactory::get();
+    CHECK(ThreadFactory::get() == mine);
+
+    IBulb* theirs   = nullptr;
+    bool   repeated = false;
+    std::thread other([&theirs, &repeated]() {
+      theirs   = ThreadFactory::get();
+      repeated = (ThreadFactory::get() == theirs);
+    });
+    other.join();
+
+    CHECK(theirs != nullptr);
+    CHECK(theirs != mine);
+    CHECK(repeated);
+  }
+
+  SUBCASE("A thread's instance is destroyed when it exits") {
+    int live_before = CountedBulb::live;
+    std::thread other([]() { ThreadFactory::get()->electrified(true); });
+    other.join();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("Lamps on one thread share that thread's bulb") {
+    exercise_lamp_wiring<GaudyLamp>();
+    GaudyLamp lamp1;
+    GaudyLamp lamp2;
+    lamp1.toggle_switch();
+    CHECK(lamp2.is_lit());
+  }
+
+  SUBCASE("A reset discards this thread's old instance") {
+    IBulb* before = ThreadFactory::get();
+    reset_all_factories();
+    ThreadFactory::declare_thread_local([]() -> IBulb* {return new Bulb;});
+    CHECK(ThreadFactory::get() != nullptr);
+    CHECK(ThreadFactory::get() == ThreadFactory::get());
+    static_cast<void>(before);
+  }
+
+  SUBCASE("A thread-local declaration is not a unique one") {
+    CHECK_THROWS_WITH(ThreadFactory::get_unique(),
+                      "DepInject: get: request for "
+                      "unique instance doesn't match declaration");
+  }
+}
+
+
+TEST_CASE("Test per-CPU instances")
+{
+  using CpuFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  CpuFactory::declare_per_cpu<CountedBulb>();
+  int live_before = CountedBulb::live;          // after the reset takes effect
+
+  std::vector<IBulb*> all;
+  auto collect = [&all]() {
+    all.clear();
+    CpuFactory::visit_per_cpu([&all](IBulb& bulb) { all.push_back(&bulb); });
+  };
+
+  SUBCASE("Nothing is built before the first get()") {
+    collect();
+    CHECK(all.empty());
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("Every CPU has an instance of its own cache lines") {
+    IBulb* mine = CpuFactory::get();
+    collect();
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    REQUIRE(all.size() == cpus);
+    CHECK(CountedBulb::live == live_before + int(cpus));
+    CHECK(std::find(all.begin(), all.end(), mine) != all.end());
+    for (std::size_t i = 0; i < all.size(); ++i) {
+      auto at = reinterpret_cast<std::uintptr_t>(all[i]);
+      CHECK(at % 64 == 0);
+      if (i)
+        CHECK(at - reinterpret_cast<std::uintptr_t>(all[i - 1]) >= 64);
+    }
+  }
+
+  SUBCASE("Every thread gets one of the instances") {
+    CpuFactory::get();
+    collect();
+    std::vector<IBulb*>      seen(4);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < seen.size(); ++t)
+      threads.emplace_back([&seen, t]() { seen[t] = CpuFactory::get(); });
+    for (auto& th : threads)
+      th.join();
+    for (IBulb* bulb : seen)
+      CHECK(std::find(all.begin(), all.end(), bulb) != all.end());
+  }
+
+  SUBCASE("The instances may be reduced to one view") {
+    CpuFactory::get()->electrified(true);
+    auto lit = CpuFactory::reduce_per_cpu(0, [](int n, IBulb& bulb) {
+      return n + (bulb.is_lit() ? 1 : 0);
+    });
+    CHECK(lit == 1);
+  }
+
+  SUBCASE("The instances are destroyed by a reset") {
+    CpuFactory::get();
+    CpuFactory::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("A per-CPU declaration is neither unique nor visited otherwise") {
+    CHECK_THROWS_WITH(CpuFactory::get_unique(),
+                      "DepInject: get: request for "
+                      "unique instance doesn't match declaration");
+    CpuFactory::testing_reset();
+    CpuFactory::declare([]() -> IBulb* {return new Bulb;});
+    CHECK_THROWS_WITH(collect(),
+                      "DepInject: visit_per_cpu: declaration is not per-CPU");
+  }
+}
+
+
+TEST_CASE("Test in-place shared instances")
+{
+  using FirstFactory  = DepInject::Factory<IBulb, GaudyTag>;
+  using SecondFactory = DepInject::Factory<IBulb, UniqueTag>;
+
+  reset_all_factories();
+  FirstFactory::declare_inplace<CountedBulb>();
+  SecondFactory::declare_inplace<CountedBulb>();
+  int live_before = CountedBulb::live;          // after the reset takes effect
+
+  SUBCASE("The instance is shared, and built in the static region") {
+    IBulb* bulb = FirstFactory::get();
+    CHECK(FirstFactory::get() == bulb);
+    CHECK(CountedBulb::live == live_before + 1);
+    CHECK(DepInject::Internals::InplaceRegion<>::contains(bulb));
+  }
+
+  SUBCASE("Instances built together lie side by side") {
+    auto first  = reinterpret_cast<std::uintptr_t>(FirstFactory::get());
+    auto second = reinterpret_cast<std::uintptr_t>(SecondFactory::get());
+    CHECK(second > first);
+    CHECK(second - first < sizeof(CountedBulb) + alignof(CountedBulb));
+  }
+
+  SUBCASE("Rebuilt instances reuse their space, still side by side") {
+    IBulb* first  = FirstFactory::get();
+    IBulb* second = SecondFactory::get();
+    // More resets than DEPINJECT_INPLACE_CAPACITY would hold fresh instances for.
+    const int resets = DEPINJECT_INPLACE_CAPACITY / sizeof(CountedBulb) + 1;
+    int       moved  = 0;
+    for (int i = 0; i < resets; ++i) {
+      reset_all_factories();
+      FirstFactory::declare_inplace<CountedBulb>();
+      SecondFactory::declare_inplace<CountedBulb>();
+      moved += FirstFactory::get() != first;
+      moved += SecondFactory::get() != second;
+    }
+    CHECK(moved == 0);
+    CHECK(DepInject::Internals::InplaceRegion<>::contains(second));
+    CHECK(CountedBulb::live == live_before + 2);
+  }
+
+  SUBCASE("Lamps share the in-place bulb") {
+    GaudyLamp lamp1;
+    GaudyLamp lamp2;
+    lamp1.toggle_switch();
+    CHECK(lamp2.is_lit());
+  }
+
+  SUBCASE("The instance is destroyed in place by a reset") {
+    FirstFactory::get();
+    FirstFactory::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+    FirstFactory::declare([]() -> IBulb* {return new Bulb;});
+    CHECK_FALSE(DepInject::Internals::InplaceRegion<>::contains(FirstFactory::get()));
+  }
+
+  SUBCASE("An in-place declaration is neither unique nor redeclared") {
+    CHECK_THROWS_WITH(FirstFactory::get_unique(),
+                      "DepInject: get: request for "
+                      "unique instance doesn't match declaration");
+    CHECK_THROWS_WITH(FirstFactory::redeclare([]() -> IBulb* {return new Bulb;}),
+                      "DepInject: redeclare: in-place declarations may not be redeclared");
+  }
+}
+
+
+TEST_CASE("Test scoped instances")
+{
+  using ScopedFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  ScopedFactory::declare_scoped<CountedBulb>();
+  int live_before = CountedBulb::live;
+
+  SUBCASE("A scoped instance needs a Scope") {
+    CHECK_THROWS_WITH(ScopedFactory::get(),
+                      "DepInject: get: scoped instance requested outside any Scope");
+  }
+
+  SUBCASE("Consumers within a Scope share its instance") {
+    DepInject::Scope scope;
+    GaudyLamp lamp1;
+    GaudyLamp lamp2;
+    lamp1.toggle_switch();
+    CHECK(lamp2.is_lit());
+    CHECK((scope.get<IBulb, GaudyTag>()) == ScopedFactory::get());
+    CHECK(CountedBulb::live == live_before + 1);
+  }
+
+  SUBCASE("Each Scope has its own instance, destroyed with it") {
+    IBulb* outer_bulb = nullptr;
+    {
+      DepInject::Scope outer;
+      outer_bulb = ScopedFactory::get();
+      {
+        DepInject::Scope inner;
+        CHECK(ScopedFactory::get() != outer_bulb);
+        CHECK(CountedBulb::live == live_before + 2);
+      }
+      CHECK(ScopedFactory::get() == outer_bulb);
+      CHECK(CountedBulb::live == live_before + 1);
+    }
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("A Scope resolves shared dependencies as usual") {
+    DepInject::basic_declaration<IBulb, Bulb>();
+    DepInject::Scope scope;
+    CHECK(scope.get<IBulb>() == DepInject::Factory<IBulb>::get());
+  }
+
+  SUBCASE("A released Scope starts afresh") {
+    DepInject::Scope scope;
+    ScopedFactory::get()->electrified(true);
+    scope.release();
+    CHECK(CountedBulb::live == live_before);
+    CHECK(!ScopedFactory::get()->is_lit());
+  }
+}
+
+
+// A bulb configured at construction.
+class DimmerBulb final : public IBulb {
+public:
+  DimmerBulb (int level, std::string const& room) : m_level(level), m_room(room) { }
+
+  int level ( ) const { return m_level; }
+  std::string const& room ( ) const { return m_room; }
+
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  int         m_level;
+  std::string m_room;
+  bool        m_is_lit {false};
+};
+
+
+TEST_CASE("Test stateful builders")
+{
+  using DimmerFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+
+  SUBCASE("A builder may capture its configuration") {
+    int         level = 7;
+    std::string room  = "hall";
+    DimmerFactory::declare_unique([level, room]() -> IBulb* {
+      return new DimmerBulb(level, room);
+    });
+    level = 0;
+    room  = "attic";
+    std::unique_ptr<IBulb> bulb(DimmerFactory::get_unique());
+    CHECK(static_cast<DimmerBulb*>(bulb.get())->level() == 7);
+    CHECK(static_cast<DimmerBulb*>(bulb.get())->room() == "hall");
+  }
+
+  SUBCASE("Constructor arguments are forwarded to each build") {
+    DepInject::basic_unique_declaration<IBulb, DimmerBulb, GaudyTag>(3, "porch");
+    std::unique_ptr<IBulb> first(DimmerFactory::get_unique());
+    std::unique_ptr<IBulb> second(DimmerFactory::get_unique());
+    CHECK(first != second);
+    CHECK(static_cast<DimmerBulb*>(second.get())->level() == 3);
+    CHECK(static_cast<DimmerBulb*>(second.get())->room() == "porch");
+  }
+
+  SUBCASE("A shared declaration with constructor arguments") {
+    DepInject::basic_declaration<IBulb, DimmerBulb, GaudyTag>(5, std::string("den"));
+    GaudyLamp lamp;
+    lamp.toggle_switch();
+    CHECK(DimmerFactory::get()->is_lit());
+    CHECK(static_cast<DimmerBulb*>(DimmerFactory::get())->level() == 5);
+  }
+
+  SUBCASE("A scoped declaration with constructor arguments") {
+    DimmerFactory::declare_scoped<DimmerBulb>(9, "study");
+    DepInject::Scope scope;
+    CHECK(static_cast<DimmerBulb*>(DimmerFactory::get())->room() == "study");
+  }
+
+#if DEPINJECT_EXCEPTIONS
+  SUBCASE("A null builder is refused") {
+    IBulb* (*none)() = nullptr;
+    CHECK_THROWS_WITH(DimmerFactory::declare(none),
+                      "DepInject: declare: no allocation function provided");
+  }
+#endif
+}
+
+
+TEST_CASE("Test batches of unique instances")
+{
+  using BatchFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  int live_before = CountedBulb::live;
+
+  SUBCASE("Instances of a named class share one aligned block") {
+    BatchFactory::declare_unique_of<CountedBulb>();
+    auto bulbs = BatchFactory::get_unique_n(8);
+    REQUIRE(bulbs.size() == 8);
+    CHECK(reinterpret_cast<std::uintptr_t>(bulbs[0].get()) % 64 == 0);
+    for (std::size_t i = 1; i < bulbs.size(); ++i) {
+      CHECK(reinterpret_cast<char*>(bulbs[i].get()) ==
+            reinterpret_cast<char*>(bulbs[0].get()) + i * sizeof(CountedBulb));
+    }
+    CHECK(CountedBulb::live == live_before + 8);
+
+    bulbs[3]->electrified(true);
+    CHECK(bulbs[3]->is_lit());
+    CHECK(!bulbs[4]->is_lit());
+
+    // Released in any order, each instance is destroyed as its handle goes.
+    bulbs[0].reset();
+    bulbs[5].reset();
+    CHECK(CountedBulb::live == live_before + 6);
+    bulbs.clear();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("A handle may outlive its siblings") {
+    BatchFactory::declare_unique_of<CountedBulb>();
+    DepInject::UniquePtr<IBulb> kept;
+    {
+      auto bulbs = BatchFactory::get_unique_n(4);
+      kept = std::move(bulbs[2]);
+    }
+    CHECK(CountedBulb::live == live_before + 1);
+    kept->electrified(true);
+    CHECK(kept->is_lit());
+    kept.reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("Other unique declarations are built one by one") {
+    BatchFactory::declare_unique(counting_bulb_builder);
+    int built_before = bulbs_built;
+    auto bulbs = BatchFactory::get_unique_n(3);
+    CHECK(bulbs.size() == 3);
+    CHECK(bulbs_built == built_before + 3);
+    CHECK(bulbs[0] != bulbs[1]);
+  }
+
+  SUBCASE("Pooled instances are recycled as usual") {
+    BatchFactory::declare_pooled(counting_bulb_builder);
+    IBulb* first = nullptr;
+    {
+      auto bulbs = BatchFactory::get_unique_n(2);
+      first = bulbs[1].get();
+      bulbs[0].reset();
+      bulbs[1].reset();
+    }
+    CHECK(BatchFactory::get_unique_ptr().get() == first);
+  }
+
+  SUBCASE("A shared declaration is refused") {
+    BatchFactory::declare(counting_bulb_builder);
+    CHECK_THROWS_WITH(BatchFactory::get_unique_n(2),
+                      "DepInject: get: "
+                      "request for unique instance doesn't match declaration");
+  }
+}
+
+
+TEST_CASE("Test resetting every factory at once")
+{
+  struct ResetA {};
+  struct ResetB {};
+  using SharedFactory = DepInject::Factory<IBulb, ResetA>;
+  using PooledFactory = DepInject::Factory<IBulb, ResetB>;
+
+  reset_all_factories();
+  int live_before = CountedBulb::live;
+
+  SharedFactory::declare([]() -> IBulb* {return new CountedBulb;});
+  IBulb* shared = SharedFactory::get();
+  CHECK(CountedBulb::live == live_before + 1);
+
+  SUBCASE("Each factory is cleared on its next use") {
+    DepInject::testing_reset_all();
+    CHECK(CountedBulb::live == live_before + 1);      // not yet touched
+    CHECK(SharedFactory::try_get().error() == DepInject::Error::not_declared);
+    CHECK(CountedBulb::live == live_before);
+    SharedFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    CHECK(SharedFactory::get() != nullptr);
+    CHECK(CountedBulb::live == live_before + 1);
+    static_cast<void>(shared);
+  }
+
+  SUBCASE("Declared dependencies are forgotten") {
+    DepInject::Factory<IBulb, ResetA>::depends_on<IBulb, ResetB>();
+    DepInject::testing_reset_all();
+    CHECK_NOTHROW((DepInject::Factory<IBulb, ResetB>::depends_on<IBulb, ResetA>()));
+    PooledFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    CHECK(DepInject::prewarm().size() == 1);
+  }
+
+  SUBCASE("Pooled instances released afterwards are not recycled") {
+    PooledFactory::declare_pooled([]() -> IBulb* {return new CountedBulb;});
+    auto bulb = PooledFactory::get_unique_ptr();
+    DepInject::testing_reset_all();
+    int live = CountedBulb::live;
+    bulb.reset();
+    CHECK(CountedBulb::live == live - 1);
+  }
+
+  SUBCASE("Thread-local and per-CPU instances leave the fast path") {
+    struct ResetC {};
+    using CpuFactory = DepInject::Factory<IBulb, ResetC>;
+    PooledFactory::declare_thread_local([]() -> IBulb* {return new StaticBulb;});
+    CHECK(PooledFactory::get() != nullptr);
+    DepInject::testing_reset_all();
+    CHECK(PooledFactory::try_get().error() == DepInject::Error::not_declared);
+    CpuFactory::declare_per_cpu<CountedBulb>();
+    CHECK(CpuFactory::get() != nullptr);
+    DepInject::testing_reset_all();
+    CHECK(CpuFactory::try_get().error() == DepInject::Error::not_declared);
+  }
+
+  reset_all_factories();
+  SharedFactory::testing_reset();
+  PooledFactory::testing_reset();
+  CHECK(CountedBulb::live == live_before);
+}
+
+
+TEST_CASE("Test redeclaring shared instances")
+{
+  using SwapFactory = DepInject::Factory<IBulb, GaudyTag>;
+
+  reset_all_factories();
+  DepInject::reclaim();
+  int live_before = CountedBulb::live;
+
+  SUBCASE("The old instance outlives any Pin that may hold it") {
+    SwapFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    {
+      DepInject::Pin pin;
+      IBulb* old_bulb = SwapFactory::get();
+      SwapFactory::redeclare([]() -> IBulb* {return new CountedBulb;});
+      CHECK(SwapFactory::get() != old_bulb);
+      CHECK(CountedBulb::live == live_before + 2);
+      CHECK(DepInject::reclaim() == 0);
+      old_bulb->electrified(true);          // still safe to use
+      CHECK(old_bulb->is_lit());
+    }
+    CHECK(DepInject::reclaim() == 1);
+    CHECK(CountedBulb::live == live_before + 1);
+    SwapFactory::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("An instance held beyond any Pin is neither replaced nor reclaimed") {
+    using LampFactory = DepInject::Factory<GaudyLamp>;
+    SwapFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    LampFactory::declare([]() {return new GaudyLamp;});
+    GaudyLamp* lamp = LampFactory::get();     // holds SwapFactory's bulb as an IBulb&
+    CHECK_THROWS_WITH(SwapFactory::redeclare([]() -> IBulb* {return new CountedBulb;}),
+                      "DepInject: redeclare: instance held by another shared instance");
+    DepInject::reclaim();
+    CHECK(CountedBulb::live == live_before + 1);
+    lamp->toggle_switch();                    // its bulb is still the one it was given
+    CHECK(lamp->is_lit());
+    CHECK(SwapFactory::get()->is_lit());
+
+    LampFactory::testing_reset();             // with the holder gone, it may be replaced
+    SwapFactory::redeclare([]() -> IBulb* {return new CountedBulb;});
+    DepInject::reclaim();
+    CHECK(CountedBulb::live == live_before + 1);
+    SwapFactory::testing_reset();
+  }
+
+  SUBCASE("An instance not yet built is just built by the new builder") {
+    bulbs_built = 0;
+    SwapFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    SwapFactory::redeclare(counting_bulb_builder);
+    CHECK(CountedBulb::live == live_before);
+    SwapFactory::get();
+    CHECK(bulbs_built == 1);
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("A failed rebuild leaves the old declaration in place") {
+    SwapFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    IBulb* bulb = SwapFactory::get();
+    CHECK_THROWS_WITH(SwapFactory::redeclare([]() -> IBulb* {return nullptr;}),
+                      "DepInject: redeclare: object allocation failed");
+    CHECK(SwapFactory::get() == bulb);
+    SwapFactory::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("Only shared declarations may be redeclared") {
+    CHECK_THROWS_WITH(SwapFactory::redeclare(counting_bulb_builder),
+                      "DepInject: redeclare: object type+tag not declared");
+    SwapFactory::declare_unique(counting_bulb_builder);
+    CHECK_THROWS_WITH(SwapFactory::redeclare(counting_bulb_builder),
+                      "DepInject: redeclare: only shared declarations may be redeclared");
+  }
+
+  SUBCASE("Pinned readers never see a destroyed instance") {
+    SwapFactory::declare([]() -> IBulb* {return new CountedBulb;});
+    std::atomic<bool>        done {false};
+    std::atomic<int>         lit  {0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+      readers.emplace_back([&done, &lit]() {
+        while (!done.load()) {
+          DepInject::Pin pin;
+          IBulb* bulb = SwapFactory::get();
+          lit += bulb->is_lit();
+        }
+      });
+    }
+    for (int i = 0; i < 200; ++i) {
+      SwapFactory::redeclare([]() -> IBulb* {return new CountedBulb;});
+      std::this_thread::yield();
+    }
+    done = true;
+    for (auto& th : readers)
+      th.join();
+    CHECK(lit == 0);
+    DepInject::reclaim();
+    CHECK(CountedBulb::live == live_before + 1);
+    SwapFactory::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  reset_all_factories();
+}
+
+
+TEST_CASE("Test bulb banks")
+{
+  BulbBank bank(200);
+
+  SUBCASE("Bulbs start dark and are lit singly") {
+    CHECK(bank.count_lit() == 0);
+    bank.electrify(130, true);
+    CHECK(bank.is_lit(130));
+    CHECK(!bank.is_lit(129));
+    CHECK(bank.count_lit() == 1);
+    CHECK_THROWS_AS(bank.electrify(200, true), std::out_of_range);
+  }
+
+  SUBCASE("Ranges are lit and darkened across words") {
+    bank.electrify(3, 190, true);
+    CHECK(bank.count_lit() == 187);
+    CHECK(!bank.is_lit(2));
+    CHECK(bank.is_lit(3));
+    CHECK(bank.is_lit(189));
+    CHECK(!bank.is_lit(190));
+    bank.electrify(60, 70, false);
+    CHECK(bank.count_lit() == 177);
+    bank.electrify(0, 200, true);
+    CHECK(bank.count_lit() == 200);
+    CHECK_THROWS_AS(bank.electrify(10, 201, true), std::out_of_range);
+  }
+
+  SUBCASE("Masks light every bulb whose bit is set") {
+    std::vector<BulbBank::Word> mask(bank.words(), 0);
+    for (std::size_t i = 0; i < 200; i += 3)
+      mask[i / BulbBank::word_bits] |= BulbBank::Word(1) << (i % BulbBank::word_bits);
+    bank.electrify(mask, true);
+    CHECK(bank.count_lit() == 67);
+    CHECK(bank.is_lit(198));
+    CHECK(!bank.is_lit(199));
+
+    // Bits beyond the last bulb are ignored.
+    std::vector<BulbBank::Word> all(bank.words(), ~BulbBank::Word(0));
+    bank.electrify(all, true);
+    CHECK(bank.count_lit() == 200);
+    bank.electrify(mask, false);
+    CHECK(bank.count_lit() == 133);
+    CHECK_THROWS_AS(bank.electrify(std::vector<BulbBank::Word>(1), true),
+                    std::invalid_argument);
+  }
+
+  SUBCASE("Lamps share the bank through IBulb views") {
+    using BankTag = UniqueTag;
+    reset_all_factories();
+    DepInject::Factory<IBulb, BankTag>::declare_unique([&bank]() { return bank.next_view(); });
+    LampWithUniqueBulb lamp1;
+    LampWithUniqueBulb lamp2;
+    lamp2.toggle_switch();
+    CHECK(!bank.is_lit(0));
+    CHECK(bank.is_lit(1));
+    CHECK(lamp2.is_lit());
+
+    bank.electrify(0, 2, true);
+    CHECK(lamp1.is_lit());
+    CHECK(bank.view(0)->is_lit());
+  }
+}
+
+
+// Names are hashed at compile time.
+static_assert(DepInject::Name("").hash() == 0xcbf29ce484222325ull, "FNV-1a offset basis");
+static_assert(DepInject::Name("a").hash() == 0xaf63dc4c8601ec8cull, "FNV-1a of \"a\"");
+
+
+TEST_CASE("Test config-driven wiring")
+{
+  reset_all_factories();
+  bulbs_built = 0;
+  int live_before = CountedBulb::live;
+
+  DepInject::Wiring wiring;
+  wiring.add_slot<IBulb>("bulb");
+  wiring.add_unique_slot<IBulb, UniqueTag>("unique bulb");
+  wiring.add_slot<IBulb, GaudyTag>("gaudy bulb");
+  wiring.add_implementation<IBulb, CountedBulb>("CountedBulb");
+  wiring.add_implementation<IBulb, GaudyBulb>("GaudyBulb");
+  wiring.add_builder<IBulb>("CountingBulb", counting_bulb_builder);
+  wiring.add_implementation<ILogger, NullLogger>("NullLogger");
+
+  SUBCASE("Slots are declared as the configuration says") {
+    std::string config = "# the lamps' bulbs\n"
+                         "bulb = CountedBulb\n"
+                         "  unique bulb =CountingBulb \r\n"
+                         "\n"
+                         "gaudy bulb\t= GaudyBulb";
+    CHECK(wiring.wire_config(config) == 3);
+
+    DepInject::Factory<IBulb>::get();
+    CHECK(CountedBulb::live == live_before + 1);
+    delete DepInject::Factory<IBulb, UniqueTag>::get_unique();
+    CHECK(bulbs_built == 1);
+    DepInject::Factory<IBulb, GaudyTag>::get();
+    auto lines = RecordingLogger::current().lines();
+    CHECK(std::count(lines.begin(), lines.end(), "gaudy bulb created") == 1);
+
+    DepInject::Factory<IBulb>::testing_reset();
+    CHECK(CountedBulb::live == live_before);
+  }
+
+  SUBCASE("Names are looked up from text read at run time") {
+    std::string slot = "bulb";
+    std::string impl = "CountedBulb";
+    wiring.wire(slot, impl);
+    CHECK_THROWS_WITH(DepInject::Factory<IBulb>::declare(counting_bulb_builder),
+                      "DepInject: declare: redeclaration for same type+tag");
+  }
+
+  SUBCASE("Mistakes are reported") {
+    CHECK_THROWS_WITH(wiring.wire("lamp", "CountedBulb"),
+                      "DepInject: wire: no slot named 'lamp'");
+    CHECK_THROWS_WITH(wiring.wire("bulb", "Bulb"),
+                      "DepInject: wire: no implementation named 'Bulb'");
+    CHECK_THROWS_WITH(wiring.wire("bulb", "NullLogger"),
+                      "DepInject: wire: implementation 'NullLogger' does not fit slot 'bulb'");
+    CHECK_THROWS_WITH(wiring.wire_config("bulb = CountedBulb\nbulb CountedBulb\n"),
+                      "DepInject: wire: line 2: expected 'slot = implementation'");
+    CHECK_THROWS_WITH(wiring.add_slot<IBulb>("bulb"),
+                      "DepInject: wiring: slot 'bulb' already registered");
+  }
+
+  SUBCASE("Many names") {
+    DepInject::Internals::NameTable<std::size_t> table;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < 1000; ++i)
+      names.push_back("binding " + std::to_string(i));
+    for (std::size_t i = 0; i < names.size(); ++i)
+      CHECK(table.insert(names[i], std::unique_ptr<std::size_t>(new std::size_t(i))));
+    CHECK(table.size() == names.size());
+    CHECK_FALSE(table.insert(names[7], std::unique_ptr<std::size_t>(new std::size_t(0))));
+    bool all_found = true;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+      std::size_t* found = table.find(names[i]);
+      all_found = all_found && found && *found == i;
+    }
+    CHECK(all_found);
+    CHECK(table.find("binding 1000") == nullptr);
+  }
+
+  reset_all_factories();
+}
+
+
+TEST_CASE("Test logging")
+{
+  reset_all_factories();
+
+  SUBCASE("Lamps and bulbs log through the declared logger") {
+    DepInject::basic_declaration<IBulb, Bulb>();
+    {
+      Lamp lamp;
+      lamp.toggle_switch();
+    }
+    auto lines = RecordingLogger::current().lines();
+    auto seen  = [&lines](char const* line) {
+      return std::find(lines.begin(), lines.end(), line) != lines.end();
+    };
+    CHECK(seen("bulb created"));
+    CHECK(seen("lamp turned on"));
+    CHECK(std::find_if(lines.begin(), lines.end(), [](std::string const& line) {
+            return line.find("destroyed") != std::string::npos;
+          }) != lines.end());
+  }
+
+  SUBCASE("An asynchronous logger writes every line, in order per thread") {
+    const int nthreads = 4;
+    const int nlines   = 20000;      // enough to fill each ring several times
+    std::ostringstream out;
+    {
+      AsyncLogger logger(out);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&logger, t, nlines]() {
+          for (int i = 0; i < nlines; ++i)
+            logger.log(std::to_string(t) + " " + std::to_string(i));
+        });
+      }
+      for (auto& th : threads)
+        th.join();
+      logger.flush();
+
+      std::istringstream in(out.str());
+      std::vector<int>   next(nthreads, 0);
+      int t = 0, i = 0, count = 0;
+      while (in >> t >> i) {
+        REQUIRE(t >= 0);
+        REQUIRE(t < nthreads);
+        CHECK(i == next[t]);
+        next[t] = i + 1;
+        ++count;
+      }
+      CHECK(count == nthreads * nlines);
+    }
+  }
+
+  SUBCASE("Long lines are written whole, and pending lines on destruction") {
+    std::ostringstream out;
+    std::string        long_line(3 * AsyncLogger::max_fragment + 7, 'x');
+    {
+      AsyncLogger logger(out);
+      logger.log(long_line);
+      logger.log("last");
+    }
+    CHECK(out.str() == long_line + "\nlast\n");
+  }
+
+  SUBCASE("A stream logger writes each line at once") {
+    std::ostringstream out;
+    StreamLogger logger(out);
+    logger.log("lamp turned on");
+    CHECK(out.str() == "lamp turned on\n");
+  }
+}
+
+
+#ifdef DEPINJECT_METRICS
+TEST_CASE("Test factory metrics")
+{
+  reset_all_factories();
+
+  struct MetricsTag {};
+  using MetricsFactory = DepInject::Factory<IBulb, MetricsTag>;
+  MetricsFactory::declare_unique([]() -> IBulb* {return new CountedBulb;});
+
+  auto find = []() -> DepInject::FactoryMetrics {
+    for (auto const& m : DepInject::metrics_snapshot()) {
+      if (m.tag.find("MetricsTag") != std::string::npos)
+        return m;
+    }
+    FAIL("MetricsTag factory not reported");
+    return {};
+  };
+  DepInject::FactoryMetrics before = find();
+  CHECK(before.dependency == "IBulb");
+
+  delete MetricsFactory::get_unique();
+  MetricsFactory::get_unique_ptr();
+  CHECK(MetricsFactory::try_get().error() == DepInject::Error::shared_mismatch);
+
+  DepInject::FactoryMetrics after = find();
+  CHECK(after.gets        - before.gets        == 1);
+  CHECK(after.unique_gets - before.unique_gets == 2);
+  CHECK(after.builds      - before.builds      == 2);
+  CHECK(after.failures    == before.failures);
+
+  std::uint64_t timed = 0;
+  for (auto n : after.build_latency)
+    timed += n;
+  CHECK(timed == after.builds);
+
+  MetricsFactory::testing_reset();
+  MetricsFactory::declare_unique([]() -> IBulb* {return nullptr;});
+  CHECK(MetricsFactory::try_get_unique().error() == DepInject::Error::allocation_failed);
+  CHECK(find().failures == after.failures + 1);
+}
+#endif
+
+
+// Tags for the build tracing test's bulbs; TracedOuter's builder retrieves TracedInner.
+struct TracedOuter {};
+struct TracedInner {};
+
+TEST_CASE("Test build tracing")
+{
+  using OuterFactory = DepInject::Factory<IBulb, TracedOuter>;
+  using InnerFactory = DepInject::Factory<IBulb, TracedInner>;
+
+  reset_all_factories();
+  DepInject::Factory<ILogger>::get();                   // built now, not while tracing
+  InnerFactory::declare([]() -> IBulb* {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    return new Bulb;
+  });
+  OuterFactory::declare([]() -> IBulb* {
+    InnerFactory::get();
+    return new Bulb;
+  });
+
+  SUBCASE("Nested builds are traced with their parents") {
+    DepInject::start_build_trace();
+    OuterFactory::get();
+    OuterFactory::get();                                // built already: no event
+    DepInject::BuildTrace trace = DepInject::stop_build_trace();
+
+    REQUIRE(trace.events.size() == 2);
+    DepInject::BuildEvent const& outer = trace.events[0];
+    DepInject::BuildEvent const& inner = trace.events[1];
+    CHECK(outer.dependency == "IBulb");
+    CHECK(outer.tag == "TracedOuter");
+    CHECK(inner.tag == "TracedInner");
+    CHECK(outer.parent == DepInject::BuildEvent::none);
+    CHECK(inner.parent == 0);
+    CHECK(outer.thread == inner.thread);
+    CHECK((outer.finished && !outer.failed));
+    CHECK(outer.start <= inner.start);
+    CHECK(inner.end <= outer.end);
+    CHECK(inner.duration() >= std::chrono::milliseconds(2));
+    CHECK(trace.self_time(0) == outer.duration() - inner.duration());
+
+    CHECK((trace.critical_path() == std::vector<std::size_t>{0, 1}));
+    CHECK(trace.name(1) == "IBulb [TracedInner]");
+
+    std::string json = trace.chrome_trace();
+    CHECK(json.find("\"name\": \"IBulb [TracedInner]\", \"cat\": \"build\", \"ph\": \"X\"") !=
+          std::string::npos);
+    CHECK(json.find("\"parent\": \"IBulb [TracedOuter]\"") != std::string::npos);
+
+    std::string dot = trace.dot_graph();
+    CHECK(dot.find("n0 [label=\"IBulb [TracedOuter]\\n1 build, ") != std::string::npos);
+    CHECK(dot.find("n0 -> n1 [label=\"1\", color=red];") != std::string::npos);
+  }
+
+  SUBCASE("Only builds while tracing are traced") {
+    InnerFactory::get();
+    DepInject::start_build_trace();
+    OuterFactory::get();
+    DepInject::BuildTrace trace = DepInject::stop_build_trace();
+    OuterFactory::testing_reset();
+    OuterFactory::declare([]() -> IBulb* {return new Bulb;});
+    OuterFactory::get();
+
+    REQUIRE(trace.events.size() == 1);
+    CHECK(trace.events[0].tag == "TracedOuter");
+    CHECK(DepInject::stop_build_trace().events.empty());
+  }
+
+  SUBCASE("Failed builds and other threads are traced") {
+    InnerFactory::testing_reset();
+    InnerFactory::declare([]() -> IBulb* {return nullptr;});
+
+    DepInject::start_build_trace();
+    std::thread([]() { CHECK_FALSE(InnerFactory::try_get()); }).join();
+    DepInject::BuildTrace trace = DepInject::stop_build_trace();
+
+    REQUIRE(trace.events.size() == 1);
+    CHECK(trace.events[0].thread == 0);                 // numbered as first seen
+    CHECK((trace.events[0].finished && trace.events[0].failed));
+  }
+
+  reset_all_factories();
+}
+
+
+// Tags for the shutdown test's bulbs; ShutdownB's builder retrieves ShutdownA.
+struct ShutdownA {};
+struct ShutdownB {};
+struct ShutdownC {};
+
+// The order in which the bulbs below were destroyed.
+static std::vector<std::string> destroy_order;
+
+template <typename Tag>
+class OrderedBulb final : public IBulb {
+public:
+  ~OrderedBulb ( ) {
+    std::lock_guard<std::mutex> lock(build_order_mutex);
+    destroy_order.push_back(DepInject::Internals::type_name<Tag>());
+  }
+
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  bool m_is_lit {false};
+};
+
+
+// A bulb using another in its destructor, recorded in destroy_order as ShutdownB.
+class TouchingBulb final : public IBulb {
+public:
+  explicit TouchingBulb (IBulb& other) : m_other(other) { }
+
+  ~TouchingBulb ( ) {
+    m_other.electrified(false);           // must not yet be destroyed
+    std::lock_guard<std::mutex> lock(build_order_mutex);
+    destroy_order.push_back("ShutdownB");
+  }
+
+private:
+  void do_electrified (bool receiving_current) override { m_is_lit = receiving_current; }
+  bool do_is_lit ( ) const override { return m_is_lit; }
+
+  IBulb& m_other;
+  bool   m_is_lit {false};
+};
+
+
+TEST_CASE("Test shutdown")
+{
+  using FactoryA = DepInject::Factory<IBulb, ShutdownA>;
+  using FactoryB = DepInject::Factory<IBulb, ShutdownB>;
+  using FactoryC = DepInject::Factory<IBulb, ShutdownC>;
+
+  reset_all_factories();
+  destroy_order.clear();
+
+  FactoryA::declare([]() -> IBulb* {return new OrderedBulb<ShutdownA>;});
+  FactoryB::declare([]() -> IBulb* {
+    FactoryA::get();
+    return new OrderedBulb<ShutdownB>;
+  });
+  FactoryC::declare([]() -> IBulb* {return new OrderedBulb<ShutdownC>;});
+
+  SUBCASE("Instances are destroyed in reverse build order") {
+    FactoryB::get();              // builds A, then B
+    FactoryC::get();
+    CHECK(DepInject::shutdown() >= 3);
+    CHECK(destroy_order == std::vector<std::string>({"ShutdownC", "ShutdownB", "ShutdownA"}));
+    CHECK_THROWS_WITH(FactoryA::get(),
+                      "DepInject: get: shared instance requested after shutdown");
+    CHECK(DepInject::prewarm().empty());
+  }
+
+  SUBCASE("Dependents go first when destroying concurrently") {
+    FactoryB::depends_on<IBulb, ShutdownA>();
+    FactoryA::get();
+    FactoryC::get();
+    FactoryB::get();
+    DepInject::shutdown(DepInject::ShutdownMode::orderly, 4);
+    CHECK(destroy_order.size() == 3);
+    auto a = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownA");
+    auto b = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownB");
+    CHECK(b < a);
+  }
+
+  SUBCASE("Dependencies a builder retrieved outlive it when destroying concurrently") {
+    FactoryB::testing_reset();
+    FactoryB::declare([]() -> IBulb* {return new TouchingBulb(*FactoryA::get());});
+    FactoryA::get();
+    FactoryC::get();
+    FactoryB::get();              // retrieves A, already built, with no depends_on()
+    DepInject::shutdown(DepInject::ShutdownMode::orderly, 4);
+    CHECK(destroy_order.size() == 3);
+    auto a = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownA");
+    auto b = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownB");
+    CHECK(b < a);
+  }
+
+  SUBCASE("Dependencies built by a nested unique builder outlive the shared one") {
+    FactoryB::testing_reset();
+    FactoryC::testing_reset();
+    FactoryC::declare_unique([]() -> IBulb* {
+      FactoryA::get();
+      return new OrderedBulb<ShutdownC>;
+    });
+    FactoryB::declare([]() -> IBulb* {
+      delete FactoryC::get_unique();        // builds A, on B's behalf
+      return new TouchingBulb(*FactoryA::get());
+    });
+    FactoryB::get();
+    DepInject::shutdown(DepInject::ShutdownMode::orderly, 4);
+    CHECK(destroy_order.size() == 3);
+    auto a = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownA");
+    auto b = std::find(destroy_order.begin(), destroy_order.end(), "ShutdownB");
+    CHECK(b < a);
+  }
+
+  SUBCASE("A fast exit skips abandonable instances") {
+    FactoryC::mark_abandonable();
+    static IBulb* abandoned = nullptr;      // (kept reachable, for leak checkers)
+    abandoned = FactoryC::get();
+    FactoryB::get();
+    DepInject::shutdown(DepInject::ShutdownMode::fast_exit);
+    CHECK(destroy_order == std::vector<std::string>({"ShutdownB", "ShutdownA"}));
+
+    // A process would exit here.
+    delete abandoned;
+    CHECK(destroy_order.size() == 3);
+  }
+
+  reset_all_factories();
 }
@@ -0,0 +1,47 @@
+// di_wiring.h -- DepInject test driver compile-time wiring
+
+//================================================================================
+//
+// Copyright © 2018 Frederick Noon.  All rights reserved.
+//
+// This file is part of DepInject.
+//
+// DepInject is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Lesser General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// DepInject is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with DepInject.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#ifndef NOON_DI_WIRING_H
+#define NOON_DI_WIRING_H
+
+//---------------------------------------------------------------------
+// Note: This header fixes the production wiring at compile time.  It is
+//       included by depinject.h itself when the build defines
+//       DEPINJECT_STATIC_WIRING="di_wiring.h" (see STATIC_WIRING in the
+//       Makefile); the unit tests keep the run-time declarations.
+//---------------------------------------------------------------------
+
+#include "depinject.h"
+#include "di_bulbs.h"
+#include "di_loggers.h"
+
+// Declared in di_lamps.h, which may be the header now including us.
+struct GaudyTag;
+
+// The bound bulbs log as they are constructed, during dynamic initialization, so
+// the logger they use is bound to one that is constant-initialized.
+DEPINJECT_BIND(ILogger, DepInject::DefaultTag, NullLogger)
+
+DEPINJECT_BIND(IBulb, DepInject::DefaultTag, Bulb)
+DEPINJECT_BIND(IBulb, GaudyTag,              GaudyBulb)
+
+#endif // NOON_DI_WIRING_H